@@ -9,12 +9,24 @@ Head-only ECS lib
 
 #include <cassert>
 #include <cstdint>
+#include <cstring>
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <bitset>
-#include <queue>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <tuple>
+#include <type_traits>
 #include <unordered_map>
-#include <set>
-#include <typeinfo>
+#include <utility>
+#include <vector>
 #include "Core/Main.h"
 #include "Core/Assertion.h"
 using namespace std;
@@ -23,417 +35,3415 @@ namespace Ecs {
 namespace Internal {
     class SystemManager;  // forward for friend declaration in System
 }
+class World;  // forward for System::mWorld
 using namespace Internal;
 
 // ecs_common.h
 //----------------------------------------------------------------
+/*
+EntityId_T:
+    packed handle, low ENTITY_INDEX_BITS are the slot index, the rest
+    is the slot generation. A destroyed slot bumps its generation, so a
+    stale handle never matches the entity that reuses the slot.
+    No live handle carries NULL_GENERATION. A slot whose generation would
+    reach it is retired instead of reused, generations never wrap.
+*/
 using EntityId_T = uint32_t;
-const EntityId_T MAX_ENTITY = 1000;
+const uint32_t ENTITY_INDEX_BITS = 22;
+// size of the index space, storage grows page by page up to it
+const EntityId_T MAX_ENTITY = 1 << ENTITY_INDEX_BITS;
+const EntityId_T ENTITY_INDEX_MASK = MAX_ENTITY - 1;
+const EntityId_T ENTITY_GENERATION_MASK = ~EntityId_T(0) >> ENTITY_INDEX_BITS;
+const EntityId_T NULL_GENERATION = ENTITY_GENERATION_MASK;
+// never alive, its index is never handed out
+const EntityId_T NULL_ENTITY = ~EntityId_T(0);
+
+inline EntityId_T EntityIndex(EntityId_T entity) { return entity & ENTITY_INDEX_MASK; }
+inline EntityId_T EntityGeneration(EntityId_T entity) { return entity >> ENTITY_INDEX_BITS; }
+inline EntityId_T MakeEntity(EntityId_T index, EntityId_T generation) {
+    return index | ((generation & ENTITY_GENERATION_MASK) << ENTITY_INDEX_BITS);
+}
+// entities per storage page, must be a power of two
+const EntityId_T ENTITY_PAGE_SIZE = 1024;
+// default entities per ParallelEach chunk
+const size_t DEFAULT_GRAIN = 4096;
+// PagedStorage pages start on a line, see View::ParallelEach()
+const size_t CACHE_LINE_SIZE = 64;
 
 using ComponentId_T = uint8_t;
 const ComponentId_T MAX_COMPONENT = 128;
 
 using Signature_T = bitset<MAX_COMPONENT>;
 
-class System {
-    public:
-        /**
-         *  Please set mSignature correctly
-         **/
-        virtual void OnSystemRegister() = 0;
-        virtual void Update() = 0;
+// fn(size_t bit) for every set bit, low to high
+template <typename Func>
+void ForEachSetBit(Signature_T signature, Func&& fn) {
+    const Signature_T low(~0ULL);
+    for (size_t word = 0; word < MAX_COMPONENT / 64; ++word, signature >>= 64) {
+        unsigned long long bits = (signature & low).to_ullong();
+        while (bits) {
+#if defined(__GNUC__) || defined(__clang__)
+            size_t bit = (size_t)__builtin_ctzll(bits);
+#else
+            size_t bit = 0;
+            while (!((bits >> bit) & 1ULL)) ++bit;
+#endif
+            fn(word * 64 + bit);
+            bits &= bits - 1;
+        }
+    }
+}
 
+// TypeIndex families
+struct ComponentFamily;
+struct SystemFamily;
 
-    protected:
-        set<EntityId_T> mEntities;
-        Signature_T mSignature;
+/*
+TypeIndex<Family>:
+    dense per-type id, assigned once on first use and then read from
+    a function-local static. Each Family counts from 0 on its own.
+*/
+template <typename Family>
+class TypeIndex {
+    public:
+        template <typename T>
+        static size_t Get() {
+            static const size_t id = Next();
+            return id;
+        }
 
-    friend class SystemManager;
+    private:
+        static size_t Next() {
+            static atomic<size_t> counter(0);
+            return counter++;
+        }
 };
 
+// process-wide component id, doubles as the Signature_T bit
+template <typename T>
+ComponentId_T ComponentTypeId() {
+    size_t id = TypeIndex<ComponentFamily>::Get<typename remove_cv<T>::type>();
+    o_assert_dbg(id < MAX_COMPONENT && "Max Component Reached");
+    return (ComponentId_T)id;
+}
+
 namespace Internal {
-// ecs_entity.h
+// ecs_paged.h
 //----------------------------------------------------------------
-/* 
-EntityManager:
-    1) entity pool
-    2) Create/Destroy Entities
-    3) Store Signature
+/*
+PagedArray<T>:
+    index -> T storage split into fixed-size pages.
+    Pages are allocated on first Assure() and never move, so memory
+    follows the highest index touched instead of MAX_ENTITY.
+    Unallocated pages read as the fill value through Get().
 */
-class EntityManager {
-    public:
-        EntityManager() {
-            mEntityCount = 0;
-            mAvailiableEntities = queue<EntityId_T>();
-            mEntityUsage.reset();
+template <typename T, EntityId_T PageSize = ENTITY_PAGE_SIZE>
+class PagedArray {
+    static_assert((PageSize & (PageSize - 1)) == 0, "PageSize must be a power of two");
 
-            for (auto i = 0 ; i < MAX_ENTITY ; i++) {
-                mAvailiableEntities.push(i);
+    public:
+        explicit PagedArray(T fill = T()) : mFill(fill) {}
+
+        // deep copy, only allocated pages
+        PagedArray(PagedArray const& other) : mFill(other.mFill) {
+            mPages.resize(other.mPages.size());
+            for (size_t page = 0; page < mPages.size(); ++page) {
+                if (!other.mPages[page]) continue;
+                mPages[page].reset(new T[PageSize]);
+                copy_n(other.mPages[page].get(), PageSize, mPages[page].get());
             }
         }
 
-        EntityId_T CreateEntity() {
-            EntityId_T entity = mAvailiableEntities.front();
-            o_assert_dbg(!mEntityUsage[entity] && "entity in use");
-
-            mEntityUsage[entity] = true;
-            mAvailiableEntities.pop();
-            mEntityCount++;
+        PagedArray& operator=(PagedArray const& other) {
+            PagedArray copy(other);
+            swap(mPages, copy.mPages);
+            mFill = copy.mFill;
+            return *this;
+        }
 
-            // init Signature
-            mSignatures[entity].reset();
+        PagedArray(PagedArray&&) = default;
+        PagedArray& operator=(PagedArray&&) = default;
 
-            return entity;
+        // page of i must exist
+        T& operator[](EntityId_T i) {
+            o_assert_dbg(HasPage(i) && "page not allocated");
+            return mPages[i / PageSize][i % PageSize];
         }
 
-        void DestroyEntity(EntityId_T entity) {
-            o_assert_dbg(mEntityUsage[entity] && "entity not in use");
+        const T& operator[](EntityId_T i) const {
+            o_assert_dbg(HasPage(i) && "page not allocated");
+            return mPages[i / PageSize][i % PageSize];
+        }
 
-            mEntityUsage[entity] = false;
-            mAvailiableEntities.push(entity);
-            mEntityCount--;
+        // read without allocating
+        T Get(EntityId_T i) const {
+            return HasPage(i) ? mPages[i / PageSize][i % PageSize] : mFill;
         }
 
-        Signature_T GetSignature(EntityId_T entity) const{
-            o_assert_dbg(mEntityUsage[entity] && "entity not in use");
+        // allocate page of i if needed
+        T& Assure(EntityId_T i) {
+            EntityId_T page = i / PageSize;
+            if (page >= mPages.size()) {
+                mPages.resize(page + 1);
+            }
+            if (!mPages[page]) {
+                mPages[page].reset(new T[PageSize]);
+                fill_n(mPages[page].get(), PageSize, mFill);
+            }
+            return mPages[page][i % PageSize];
+        }
 
-            return mSignatures[entity];
+        // allocate every page covering [begin, end)
+        void AssureRange(EntityId_T begin, EntityId_T end) {
+            for (EntityId_T i = begin; i < end; i = (i / PageSize + 1) * PageSize) {
+                Assure(i);
+            }
         }
 
-        void SetSignature(EntityId_T entity, Signature_T signature) {
-            o_assert_dbg(mEntityUsage[entity] && "entity not in use");
+        // first element of the page holding i, page must exist
+        T* PageData(EntityId_T i) {
+            o_assert_dbg(HasPage(i) && "page not allocated");
+            return mPages[i / PageSize].get();
+        }
 
-            mSignatures[entity] = signature;
+        bool HasPage(EntityId_T i) const {
+            EntityId_T page = i / PageSize;
+            return page < mPages.size() && mPages[page];
         }
 
-        EntityId_T Size() const { return mEntityCount; }
+        size_t PageCount() const {
+            size_t count = 0;
+            for (auto const &page : mPages) {
+                if (page) count++;
+            }
+            return count;
+        }
 
     private:
-        bitset<MAX_ENTITY> mEntityUsage;
-        queue<EntityId_T> mAvailiableEntities;
-        // component list
-        array<Signature_T, MAX_ENTITY> mSignatures;
-        EntityId_T mEntityCount;
+        vector<unique_ptr<T[]>> mPages;
+        T mFill;
 };
 
 
-// ecs_component.h
-//----------------------------------------------------------------
 /*
-IComponentArray:
-    Tow designs on clean up.
-    A: EttManager.GetSignature() 
-        => ComponentManager.RemoveComponent(entity, typeid) for all typeid
-    B: ComponentManager.OnEntityDestroy()
-        => ComponentArray<T>.OnEntityDestroy() for all T
+IsTriviallyRelocatable<T>:
+    T can be moved by copying its bytes and forgetting the source.
+    Defaults to trivially copyable, specialize for other types known to
+    be safe (no self pointers), e.g. unique_ptr with a deleter that is
+    itself trivially relocatable.
 */
-class IComponentArray {
-    
+template <typename T>
+struct IsTriviallyRelocatable : is_trivially_copyable<T> {};
 
-    public:
-        virtual ~IComponentArray() = default;
-        virtual void RemoveComponent(EntityId_T entity) = 0;
-};
+template <typename T, typename D>
+struct IsTriviallyRelocatable<unique_ptr<T, D>> : IsTriviallyRelocatable<D> {};
+
+template <typename T>
+struct IsTriviallyRelocatable<default_delete<T>> : true_type {};
 
 /*
-ComponentArray<T>:
-    maintain components of type T. Know relative eneity ids
+IsTag<T>:
+    T carries no data and lives only as its bit in the entity's
+    Signature_T, no ComponentArray. Defaults to empty types.
 */
 template <typename T>
-class ComponentArray : public IComponentArray {
-    public:
-        ComponentArray() {
-            // mDataArray = array<T, MAX_ENTITY>();
-            // mId2Entity = array<EntityId_T, MAX_ENTITY>();
-            mEntity2Id = array<EntityId_T, MAX_ENTITY>();
-            mEntity2Id.fill(MAX_ENTITY);
-            mSize = 0;
-        }
+struct IsTag : is_empty<T> {};
 
-        void AddComponent(EntityId_T entity, T component) {
-            o_assert_dbg(entity < MAX_ENTITY && "entity out of range");
-            o_assert_dbg(mEntity2Id[entity] == MAX_ENTITY && "entity exist");
+/*
+    move-construct count elements at dst from src, then end the
+    lifetime of src. One memcpy for trivially relocatable T.
+*/
+template <typename T>
+void RelocateRange(T* dst, T* src, size_t count, true_type) {
+    memcpy(static_cast<void*>(dst), static_cast<const void*>(src), sizeof(T) * count);
+}
 
-            // attach to last
-            mDataArray[mSize] = move(component);
-            // set id
-            mEntity2Id[entity] = mSize;
-            // set entity
-            mId2Entity[mSize] = entity;
+template <typename T>
+void RelocateRange(T* dst, T* src, size_t count, false_type) {
+    for (size_t i = 0; i < count; ++i) {
+        new (dst + i) T(move(src[i]));
+        src[i].~T();
+    }
+}
 
-            mSize++;
+template <typename T>
+void RelocateRange(T* dst, T* src, size_t count) {
+    RelocateRange(dst, src, count, integral_constant<bool, IsTriviallyRelocatable<T>::value>());
+}
+
+/*
+PagedStorage<T>:
+    like PagedArray but pages are raw, uninitialized memory aligned to
+    a cache line (or alignof(T) if larger). The owner constructs/destroys
+    elements itself, so an unused slot costs nothing and T needs no
+    default constructor.
+*/
+template <typename T, EntityId_T PageSize = ENTITY_PAGE_SIZE>
+class PagedStorage {
+    static_assert((PageSize & (PageSize - 1)) == 0, "PageSize must be a power of two");
+
+    struct Page {
+        unique_ptr<unsigned char[]> raw;
+        T* data;
+    };
+
+    public:
+        PagedStorage() = default;
+        PagedStorage(PagedStorage const&) = delete;
+        void operator=(PagedStorage const&) = delete;
+
+        // page of i must exist, element may be unconstructed
+        T* Slot(EntityId_T i) {
+            o_assert_dbg(HasPage(i) && "page not allocated");
+            return mPages[i / PageSize].data + i % PageSize;
         }
 
-        void RemoveComponent(EntityId_T entity) override {
-            o_assert_dbg(entity < MAX_ENTITY && "entity out of range");
-            o_assert_dbg(mEntity2Id[entity] < mSize && "entity not exist");
+        T const* Slot(EntityId_T i) const {
+            o_assert_dbg(HasPage(i) && "page not allocated");
+            return mPages[i / PageSize].data + i % PageSize;
+        }
 
-            mSize--;
+        T& operator[](EntityId_T i) { return *Slot(i); }
+        T const& operator[](EntityId_T i) const { return *Slot(i); }
 
-            // move last data to fill the gap, update id
-            EntityId_T gapId = mEntity2Id[entity];
-            mDataArray[gapId] = mDataArray[mSize];
-            // update last data's id <-> entity
-            mEntity2Id[mId2Entity[mSize]] = gapId;
-            mId2Entity[gapId] = mId2Entity[mSize];
-            // init removed entity id
-            mEntity2Id[entity] = MAX_ENTITY;
+        // allocate page of i if needed, returns the raw slot
+        T* Assure(EntityId_T i) {
+            EntityId_T page = i / PageSize;
+            if (page >= mPages.size()) {
+                mPages.resize(page + 1);
+            }
+            if (!mPages[page].data) {
+                // over-allocate so the page can be aligned
+                size_t bytes = sizeof(T) * PageSize + PAGE_ALIGN;
+                mPages[page].raw.reset(new unsigned char[bytes]);
+                void* ptr = mPages[page].raw.get();
+                mPages[page].data = static_cast<T*>(align(PAGE_ALIGN, sizeof(T) * PageSize, ptr, bytes));
+            }
+            return mPages[page].data + i % PageSize;
         }
 
-        T& GetComponent(EntityId_T entity) {
-            o_assert_dbg(entity < MAX_ENTITY && "entity out of range");
-            o_assert_dbg(mEntity2Id[entity] < mSize && "entity not exist");
+        T* PageData(EntityId_T i) { return Slot(i - i % PageSize); }
 
-            return mDataArray[mEntity2Id[entity]];
+        bool HasPage(EntityId_T i) const {
+            EntityId_T page = i / PageSize;
+            return page < mPages.size() && mPages[page].data;
         }
 
-        EntityId_T Size() {
-            return mSize;
+        size_t PageCount() const {
+            size_t count = 0;
+            for (auto const &page : mPages) {
+                if (page.data) count++;
+            }
+            return count;
         }
 
     private:
-        EntityId_T mSize;
+        static const size_t PAGE_ALIGN = alignof(T) > CACHE_LINE_SIZE ? alignof(T) : CACHE_LINE_SIZE;
 
-        array<T, MAX_ENTITY> mDataArray;
-        array<EntityId_T, MAX_ENTITY> mEntity2Id;
-        array<EntityId_T, MAX_ENTITY> mId2Entity;
+        vector<Page> mPages;
 };
 
-
 /*
-ComponentManager:
-    maintain ComponentArray with different type
-
-    index ComponentArray<T> using string pointer of T type_info::name
+EntitySet:
+    sparse set of entities, same layout as ComponentArray without data.
+    O(1) Insert/Erase/Contains through the paged sparse index, iteration
+    is a linear walk over the dense vector (unordered, swap-remove).
 */
-class ComponentManager {
+class EntitySet {
     public:
-        ComponentManager() {
-            mSize = 0;
-        }
+        EntitySet() : mEntity2Id(MAX_ENTITY) {}
 
-        template <typename T>
-        void RegisterComponent() {
-            const char* name = typeid(T).name();
-            o_assert_dbg(mName2Id.find(name) == mName2Id.end() && "Component Registered");            
-            o_assert_dbg(mSize < MAX_COMPONENT && "Max Component Reached");
+        // false if already present
+        bool Insert(EntityId_T entity) {
+            if (Contains(entity)) return false;
 
-            mName2Id[name] = mSize;
-            mId2Array[mSize] = make_shared<ComponentArray<T>>();
+            mEntity2Id.Assure(EntityIndex(entity)) = (EntityId_T)mDense.size();
+            mDense.push_back(entity);
+            return true;
+        }
 
-            mSize++;
+        // false if not present
+        bool Erase(EntityId_T entity) {
+            if (!Contains(entity)) return false;
+
+            // move last entity to fill the gap
+            EntityId_T gapId = mEntity2Id[EntityIndex(entity)];
+            EntityId_T last = mDense.back();
+            mDense[gapId] = last;
+            mEntity2Id[EntityIndex(last)] = gapId;
+            mDense.pop_back();
+            mEntity2Id[EntityIndex(entity)] = MAX_ENTITY;
+            return true;
         }
 
-        template <typename T>
-        ComponentId_T AddComponent(EntityId_T entity, T component) {
-            const char* name = typeid(T).name();
-            o_assert_dbg(mName2Id.find(name) != mName2Id.end() && "Component Not Registered");
+        // exact handle match, a stale generation is not contained
+        bool Contains(EntityId_T entity) const {
+            EntityId_T id = mEntity2Id.Get(EntityIndex(entity));
+            return id < mDense.size() && mDense[id] == entity;
+        }
 
-            ComponentId_T id = mName2Id[name];
-            static_pointer_cast<ComponentArray<T>>(mId2Array[id])->AddComponent(entity, component);
+        // erase every entity matching pred in one backward pass
+        template <typename Pred>
+        void EraseIf(Pred&& pred) {
+            for (size_t i = mDense.size(); i-- > 0;) {
+                if (pred(mDense[i])) {
+                    Erase(mDense[i]);
+                }
+            }
+        }
 
-            return id;
+        void Clear() {
+            for (auto entity : mDense) {
+                mEntity2Id[EntityIndex(entity)] = MAX_ENTITY;
+            }
+            mDense.clear();
         }
-        
-        template <typename T>
-        ComponentId_T RemoveComponent(EntityId_T entity) {
-            const char* name = typeid(T).name();
-            o_assert_dbg(mName2Id.find(name) != mName2Id.end() && "Component Not Registered");
 
-            ComponentId_T id = mName2Id[name];
-            static_pointer_cast<ComponentArray<T>>(mId2Array[id])->RemoveComponent(entity);
+        size_t Size() const { return mDense.size(); }
+        bool Empty() const { return mDense.empty(); }
 
-            return id;
-        }
+        vector<EntityId_T>::const_iterator begin() const { return mDense.begin(); }
+        vector<EntityId_T>::const_iterator end() const { return mDense.end(); }
 
-        // void RemoveComponent(EntityId_T entity, ComponentId_T componentId) {
-        //     o_assert_dbg(componentId < mSize && "Component Not Registered");
+    private:
+        PagedArray<EntityId_T> mEntity2Id;
+        vector<EntityId_T> mDense;
+};
 
-        //     mId2Array[componentId]->RemoveComponent(entity);
-        // }
+/*
+EntityHashMap:
+    entity index -> dense id, open addressing with linear probing.
+    Memory follows the number of keys instead of the highest index, for
+    components only a few entities hold. Erase shifts the rest of the
+    probe run back, so there are no tombstones to skip or purge.
+*/
+class EntityHashMap {
+    struct Slot {
+        EntityId_T key;
+        EntityId_T value;
+    };
 
-        void RemoveAllComponents(EntityId_T entity, Signature_T signature) {
-            for (size_t i = 0; i < mSize; ++i) {
-                if (signature.test(i))
-                    mId2Array[i]->RemoveComponent(entity);
-            }
+    public:
+        EntityHashMap() {
+            mCount = 0;
+            mShift = 32;
         }
 
-        template <typename T>
-        T& GetComponent(EntityId_T entity) {
-            const char* name = typeid(T).name();
-            o_assert_dbg(mName2Id.find(name) != mName2Id.end() && "Component Not Registered");
-
-            return static_pointer_cast<ComponentArray<T>>(mId2Array[mName2Id[name]])->GetComponent(entity);
+        // MAX_ENTITY if absent
+        EntityId_T Get(EntityId_T key) const {
+            if (mSlots.empty()) return MAX_ENTITY;
+            for (size_t i = Home(key);; i = Next(i)) {
+                if (mSlots[i].key == key) return mSlots[i].value;
+                if (mSlots[i].key == EMPTY) return MAX_ENTITY;
+            }
         }
 
-        ComponentId_T Size() const { return mSize; }
-        
-        template <typename T>
-        ComponentId_T GetComponentId() const {
-            const char* name = typeid(T).name();
-            o_assert_dbg(mName2Id.find(name) != mName2Id.end() && "Component Not Registered");
+        // insert or overwrite
+        void Set(EntityId_T key, EntityId_T value) {
+            // keep the load at or below 3/4
+            if ((mCount + 1) * 4 > mSlots.size() * 3) {
+                Rehash(max(mSlots.size() * 2, (size_t)16));
+            }
+            size_t i = Home(key);
+            while (mSlots[i].key != key && mSlots[i].key != EMPTY) i = Next(i);
+            if (mSlots[i].key == EMPTY) mCount++;
+            mSlots[i].key = key;
+            mSlots[i].value = value;
+        }
 
-            return mName2Id.at(name);
+        void Erase(EntityId_T key) {
+            if (mSlots.empty()) return;
+            size_t gap = Home(key);
+            while (mSlots[gap].key != key) {
+                if (mSlots[gap].key == EMPTY) return;
+                gap = Next(gap);
+            }
+            // pull back every later key whose home is not in (gap, i]
+            for (size_t i = Next(gap); mSlots[i].key != EMPTY; i = Next(i)) {
+                size_t home = Home(mSlots[i].key);
+                bool stays = gap < i ? gap < home && home <= i : gap < home || home <= i;
+                if (!stays) {
+                    mSlots[gap] = mSlots[i];
+                    gap = i;
+                }
+            }
+            mSlots[gap].key = EMPTY;
+            mCount--;
         }
 
+        size_t Size() const { return mCount; }
+        size_t Capacity() const { return mSlots.size(); }
+
     private:
-        ComponentId_T mSize;
-        unordered_map<const char *, ComponentId_T> mName2Id;
-        array<shared_ptr<IComponentArray>, MAX_COMPONENT> mId2Array;
+        static const EntityId_T EMPTY = MAX_ENTITY;
+
+        vector<Slot> mSlots;
+        size_t mCount;
+        // 32 - log2(capacity), Fibonacci hashing keeps the high bits
+        uint32_t mShift;
+
+        size_t Home(EntityId_T key) const { return (uint32_t)(key * 2654435769u) >> mShift; }
+        size_t Next(size_t i) const { return (i + 1) & (mSlots.size() - 1); }
+
+        void Rehash(size_t capacity) {
+            vector<Slot> old(capacity, Slot{ EMPTY, 0 });
+            old.swap(mSlots);
+            mShift = 32;
+            for (size_t c = capacity; c > 1; c >>= 1) mShift--;
+            for (auto const &slot : old) {
+                if (slot.key == EMPTY) continue;
+                size_t i = Home(slot.key);
+                while (mSlots[i].key != EMPTY) i = Next(i);
+                mSlots[i] = slot;
+            }
+        }
 };
 
+} // namespace Internal
 
-// ecs_system.h
-// ----------------------------------------------------------------
-
-
+// ecs_job.h
+//----------------------------------------------------------------
 /*
-SystemManager
-    Maintain Systems and entites list in each system
+ThreadPool:
+    fixed set of worker threads draining one FIFO task queue.
+    A thread waiting on work it submitted should call HelpUntil()
+    instead of blocking, so nested submits cannot starve the pool.
+    Tasks carry the group they were submitted with, and a helping
+    thread only runs tasks of the group it waits on. So a thread never
+    picks up another world's or another batch's work, e.g. when several
+    worlds share the pool.
 */
-class SystemManager {
+class ThreadPool {
     public:
-        SystemManager() {}
+        // the caller helps while waiting, so default to one less than the cores
+        explicit ThreadPool(size_t workers = DefaultWorkerCount()) {
+            mStop = false;
+            for (size_t i = 0; i < workers; ++i) {
+                mWorkers.emplace_back([this, i] { WorkerLoop(i + 1); });
+            }
+        }
 
-        template <typename T>
-        shared_ptr<T> RegisterSystem() {
-            const char* name = typeid(T).name();
-            static_assert(std::is_base_of<System, T>::value, "T not derived from System");
-            o_assert_dbg(mName2System.find(name) == mName2System.end() && "System Registered");
+        ~ThreadPool() {
+            {
+                lock_guard<mutex> lock(mMutex);
+                mStop = true;
+            }
+            mCondition.notify_all();
+            for (auto &worker : mWorkers) {
+                worker.join();
+            }
+        }
 
-            auto ptr = make_shared<T>();
-            mName2System[name] = static_pointer_cast<System>(ptr);
-            ptr->OnSystemRegister();
-            return ptr;
+        ThreadPool(ThreadPool const&) = delete;
+        void operator=(ThreadPool const&) = delete;
+
+        // group tags the task for HelpUntil(), any address unique to the batch
+        void Submit(function<void()> task, const void* group = nullptr) {
+            {
+                lock_guard<mutex> lock(mMutex);
+                mTasks.push_back({group, move(task)});
+            }
+            mCondition.notify_one();
         }
-        
 
-        void OnEntityDestroy(EntityId_T entity) {
-            // remove from all systems
-            for (auto const& pair : mName2System) {
-                shared_ptr<System> system = pair.second;
-                system->mEntities.erase(entity);
+        // run the oldest queued task of group on the calling thread, false if none
+        bool TryRunOne(const void* group) {
+            function<void()> task;
+            {
+                lock_guard<mutex> lock(mMutex);
+                auto it = find_if(mTasks.begin(), mTasks.end(), [group](Task const &queued) {
+                    return queued.group == group;
+                });
+                if (it == mTasks.end()) return false;
+                task = move(it->run);
+                mTasks.erase(it);
             }
+            task();
+            return true;
         }
 
-        void OnEntitySignatureUpdate(EntityId_T entity, Signature_T const &signature) {
-            // validate all systems
-            for (auto const &pair : mName2System) {
-                shared_ptr<System> system = pair.second;
-                if ((signature & system->mSignature) == system->mSignature) {
-                    system->mEntities.insert(entity);
-                } else {
-                    system->mEntities.erase(entity);
+        // run queued tasks of group until done() holds
+        template <typename Pred>
+        void HelpUntil(const void* group, Pred&& done) {
+            while (!done()) {
+                if (!TryRunOne(group)) {
+                    this_thread::yield();
                 }
             }
         }
 
-        template <typename T>
-        shared_ptr<T> GetSystem() {
-            const char* name = typeid(T).name();
-            o_assert_dbg(mName2System.find(name) != mName2System.end() && "System Not Registerd");
+        size_t WorkerCount() const { return mWorkers.size(); }
 
-            return mName2System[name];
+        // 1 + worker number on this pool's workers, 0 on any other thread
+        size_t WorkerIndex() const {
+            WorkerTag &tag = CurrentWorker();
+            return tag.pool == this ? tag.index : 0;
         }
 
-        size_t Size() const {
-            return mName2System.size();
+        static size_t DefaultWorkerCount() {
+            size_t cores = thread::hardware_concurrency();
+            return cores > 1 ? cores - 1 : 0;
         }
+
     private:
-        unordered_map<const char *, shared_ptr<System>> mName2System;
+        struct Task {
+            const void* group;
+            function<void()> run;
+        };
+
+        vector<thread> mWorkers;
+        deque<Task> mTasks;
+        mutex mMutex;
+        condition_variable mCondition;
+        bool mStop;
+
+        struct WorkerTag {
+            const ThreadPool* pool;
+            size_t index;
+        };
+
+        static WorkerTag& CurrentWorker() {
+            static thread_local WorkerTag tag = {nullptr, 0};
+            return tag;
+        }
+
+        void WorkerLoop(size_t index) {
+            CurrentWorker() = {this, index};
+            for (;;) {
+                function<void()> task;
+                {
+                    unique_lock<mutex> lock(mMutex);
+                    mCondition.wait(lock, [this] { return mStop || !mTasks.empty(); });
+                    if (mStop && mTasks.empty()) return;
+                    task = move(mTasks.front().run);
+                    mTasks.pop_front();
+                }
+                task();
+            }
+        }
 };
 
-} // namespace Internal
+/*
+    fn(begin, end) over [0, count) split into grain-sized chunks.
+    Helpers on the pool and the calling thread claim chunks from a shared
+    atomic cursor until none are left, so a slow chunk never holds up
+    the others (the balancing work stealing would give, without per
+    worker queues). Runs inline without a pool or for a single chunk.
+*/
+template <typename Func>
+void ParallelFor(ThreadPool* pool, size_t count, size_t grain, Func&& fn) {
+    grain = max(grain, (size_t)1);
+    size_t chunks = (count + grain - 1) / grain;
+    if (!pool || pool->WorkerCount() == 0 || chunks <= 1) {
+        if (count) fn((size_t)0, count);
+        return;
+    }
+
+    // outlives this call for helpers that start after the last chunk
+    struct State {
+        atomic<size_t> next;
+        atomic<size_t> done;
+    };
+    auto state = make_shared<State>();
+    state->next = 0;
+    state->done = 0;
+    auto* body = &fn;
+    auto work = [state, body, count, grain, chunks] {
+        for (size_t chunk; (chunk = state->next.fetch_add(1)) < chunks;) {
+            size_t begin = chunk * grain;
+            (*body)(begin, min(begin + grain, count));
+            state->done.fetch_add(1, memory_order_release);
+        }
+    };
+
+    size_t helpers = min(pool->WorkerCount(), chunks - 1);
+    for (size_t i = 0; i < helpers; ++i) {
+        pool->Submit(work, state.get());
+    }
+    work();
+    pool->HelpUntil(state.get(), [&] { return state->done.load(memory_order_acquire) == chunks; });
+}
 
-// ecs_engine.h
-//----------------------------------------------------------------
-class EcsEngine {
+// one entity's signature transition, after is none once destroyed
+struct SignatureEvent {
+    EntityId_T entity;
+    Signature_T before;
+    Signature_T after;
+};
+
+class System {
     public:
-        //----------------------------------------------------------------
-        // Singleton
-        //----------------------------------------------------------------
-        EcsEngine(EcsEngine const&) = delete;
-        void operator=(EcsEngine const&) = delete;
+        /**
+         *  Please set mSignature correctly (Exclude<>() keeps entities
+         *  out), and declare component access with Read<>()/Write<>().
+         *  Optional components are declared through access only.
+         **/
+        virtual void OnSystemRegister() = 0;
+        virtual void Update() = 0;
 
-        static EcsEngine& GetInstance() {
-            static EcsEngine instance;
-            return instance;
-        }
+        /**
+         *  Reactive hooks, one call per observed type per frame after
+         *  Update() with everything since the last call, see Observe*<>().
+         *  Handles may be stale by then, removed components are gone.
+         *  A tag reports its bit being set/cleared.
+         **/
+        virtual void OnComponentsAdded(ComponentId_T, const EntityId_T*, size_t) {}
+        virtual void OnComponentsRemoved(ComponentId_T, const EntityId_T*, size_t) {}
+        virtual void OnSignaturesChanged(const SignatureEvent*, size_t) {}
 
-        //----------------------------------------------------------------
-        // Functions
-        //----------------------------------------------------------------
-        
-        EntityId_T CreateEntity() {
-            return mEntityManager->CreateEntity();
+
+    protected:
+        EntitySet mEntities;
+        Signature_T mSignature;
+        // an entity with any of these bits never enters mEntities
+        Signature_T mExclude;
+        // components read/written in Update(), drive the parallel schedule.
+        // a system declaring neither runs alone
+        Signature_T mReads;
+        Signature_T mWrites;
+        // tick of the previous Update(), 0 before the first one.
+        // Changed<T>(mLastRunTick) sees every write since then, at least once
+        uint32_t mLastRunTick = 0;
+        // events handed to the reactive hooks, set in OnSystemRegister()
+        Signature_T mObserveAdded;
+        Signature_T mObserveRemoved;
+        bool mObserveSignatures = false;
+        // the world this system runs in, nullptr outside of one
+        World* mWorld = nullptr;
+
+        template <typename... Ts>
+        void ObserveAdded() {
+            int expand[] = { 0, (mObserveAdded.set(ComponentTypeId<Ts>(), true), 0)... };
+            (void)expand;
         }
 
-        void DestroyEntity(EntityId_T entity) {
-            Signature_T signature = mEntityManager->GetSignature(entity);
-            mComponentManager->RemoveAllComponents(entity, move(signature));
-            mSystemManager->OnEntityDestroy(entity);
-            mEntityManager->DestroyEntity(entity);
+        template <typename... Ts>
+        void ObserveRemoved() {
+            int expand[] = { 0, (mObserveRemoved.set(ComponentTypeId<Ts>(), true), 0)... };
+            (void)expand;
         }
 
-        // ----------------------------------------------------------------
+        void ObserveSignatures() { mObserveSignatures = true; }
 
-        template <typename T>
-        void ResisterComponent() { 
-            mComponentManager->RegisterComponent<T>();
+        template <typename... Ts>
+        void Exclude() {
+            int expand[] = { 0, (mExclude.set(ComponentTypeId<Ts>(), true), 0)... };
+            (void)expand;
         }
 
-        template <typename T>
-        void AddComponent(EntityId_T entity, T component) {
-            auto id = mComponentManager->AddComponent<T>(entity, move(component));
-            auto signature = mEntityManager->GetSignature(entity);
-            signature.set(id, true);
-            mSystemManager->OnEntitySignatureUpdate(entity, signature);
-            mEntityManager->SetSignature(entity, move(signature));
+        template <typename... Ts>
+        void Read() {
+            int expand[] = { 0, (mReads.set(ComponentTypeId<Ts>(), true), 0)... };
+            (void)expand;
         }
 
-        template <typename T>
-        void RemoveComponent(EntityId_T entity, T component) {
-            auto id = mComponentManager->RemoveComponent<T>(entity);
-            auto signature = mEntityManager->GetSignature(entity);
-            signature.set(id, false);
-            mSystemManager->OnEntitySignatureUpdate(entity, signature);
-            mEntityManager->SetSignature(entity, move(signature));
+        template <typename... Ts>
+        void Write() {
+            int expand[] = { 0, (mWrites.set(ComponentTypeId<Ts>(), true), 0)... };
+            (void)expand;
         }
 
-        template <typename T>
-        T& GetComponent(EntityId_T entity) {
-            return mComponentManager->GetComponent<T>(entity);
-        }
+    friend class Internal::SystemManager;
+};
 
-        template <typename T>
-        ComponentId_T GetComponentId() const { 
-            return mComponentManager->GetComponentId<T>();
-        }
+/*
+Storage:
+    per-type storage policies for RegisterComponent<T, Storage>. All of
+    them keep components and entities densely packed for iteration and
+    differ in the sparse entity -> slot index and where the data lives.
+
+    Paged: sparse index in pages, memory follows the highest entity
+           index holding a T. The default.
+    Dense: one flat sparse array, a lookup skips the page indirection.
+           Costs 4 bytes per entity index up to the highest holder.
+    Hash:  open addressing map, memory follows the number of holders.
+           For components a small fraction of entities own.
+    Boxed: paged index, each T in its own allocation and the dense side
+           holds pointers. For large types, relocation moves a pointer
+           and no page of T-sized slots is reserved. A T never moves.
+    Stable: paged index, removal leaves a hole instead of moving the
+           last component in, so T& stays valid until Compact(). Holes
+           are refilled by later adds and skipped by iteration.
+*/
+namespace Storage {
+    enum Index { PAGED_INDEX, FLAT_INDEX, HASH_INDEX };
+
+    struct Paged {
+        static const Index index = PAGED_INDEX;
+        static const bool boxed = false;
+        static const bool stable = false;
+    };
+
+    struct Dense {
+        static const Index index = FLAT_INDEX;
+        static const bool boxed = false;
+        static const bool stable = false;
+    };
+
+    struct Hash {
+        static const Index index = HASH_INDEX;
+        static const bool boxed = false;
+        static const bool stable = false;
+    };
+
+    struct Boxed {
+        static const Index index = PAGED_INDEX;
+        static const bool boxed = true;
+        static const bool stable = false;
+    };
+
+    struct Stable {
+        static const Index index = PAGED_INDEX;
+        static const bool boxed = false;
+        static const bool stable = true;
+    };
+}
 
-        // ---------------------------------------------------------------------
+namespace Internal {
+// ecs_entity.h
+//----------------------------------------------------------------
+/* 
+EntityManager:
+    1) entity pool
+    2) Create/Destroy Entities
+    3) Store Signature
 
-        template <typename T>
-        shared_ptr<T> ResisterSystem() {
-            shared_ptr<T> system = mSystemManager->RegisterSystem<T>();
-            static_pointer_cast<System>(system)->OnSystemRegister();
-            return system;
+    mSlots holds, per index, the handle of the live entity, or for a
+    free slot the next free index plus the generation its next handle
+    gets. Free slots form an intrusive LIFO list from mFreeHead. A
+    handle is alive iff mSlots[index] == handle, one compare.
+    Indices past mNextEntity were never used and are not on the list,
+    they read as UNUSED. Its index is 0 and slot 0 is set up front, so
+    no handle ever matches an unused slot.
+    A slot that used up its generations holds NULL_ENTITY and stays off
+    the list for good, a hot slot retires after NULL_GENERATION lives.
+
+    ReserveEntity() hands out pending handles from any thread without a
+    lock, one atomic counter, leaving the slots alone. A pending handle
+    carries NULL_GENERATION and the counter value as its index, so it is
+    never alive. CreateReserved() gives it a slot in whatever order the
+    caller picks, mReservedIds maps it to that entity until
+    ClearReserved() starts the counter over.
+*/
+class EntityManager {
+    public:
+        EntityManager() : mSlots(UNUSED) {
+            mSlots.Assure(0) = FREE_END;
+            mEntityCount = 0;
+            mNextEntity = 0;
+            mFreeHead = FREE_END;
+            mReserved = 0;
         }
 
-        template <typename T>
-        shared_ptr<T> GetSystem() {
-            return mSystemManager->GetSystem<T>();
+        // pending handles resolve the same in the copy
+        EntityManager(EntityManager const& other)
+            : mSlots(other.mSlots), mSignatures(other.mSignatures), mReservedIds(other.mReservedIds) {
+            mEntityCount = other.mEntityCount;
+            mNextEntity = other.mNextEntity;
+            mFreeHead = other.mFreeHead;
+            mReserved.store(other.mReserved.load(memory_order_relaxed), memory_order_relaxed);
+        }
+
+        void operator=(EntityManager const&) = delete;
+
+        EntityId_T CreateEntity() {
+            EntityId_T entity = NextEntity();
+            mEntityCount++;
+
+            // init Signature
+            mSignatures[EntityIndex(entity)].reset();
+
+            return entity;
+        }
+
+        void DestroyEntity(EntityId_T entity) {
+            o_assert_dbg(IsAlive(entity) && "entity not in use");
+
+            // bump generation, push on the free list
+            EntityId_T index = EntityIndex(entity);
+            EntityId_T generation = EntityGeneration(entity) + 1;
+            if (generation == NULL_GENERATION) {
+                // out of generations, a reuse could match stale handles
+                mSlots[index] = NULL_ENTITY;
+            } else {
+                mSlots[index] = MakeEntity(mFreeHead, generation);
+                mFreeHead = index;
+            }
+            Touch(index);
+            mEntityCount--;
+        }
+
+        /*
+            lock free, callable from several threads at once and next to
+            anything but CreateReserved()/ClearReserved(). The pending
+            handle is not alive until CreateReserved() is called on it.
+        */
+        EntityId_T ReserveEntity() {
+            EntityId_T number = mReserved.fetch_add(1, memory_order_relaxed);
+            o_assert_dbg(number < FREE_END && "Max Entity Reached");
+            return MakeEntity(number, NULL_GENERATION);
+        }
+
+        // handed out by ReserveEntity(), created or not
+        static bool IsReserved(EntityId_T entity) {
+            return EntityGeneration(entity) == NULL_GENERATION && entity != NULL_ENTITY;
+        }
+
+        // the entity of a pending handle, created on the first call.
+        // NULL_ENTITY for handles from before the last ClearReserved()
+        EntityId_T CreateReserved(EntityId_T pending) {
+            o_assert_dbg(IsReserved(pending) && "not a pending handle");
+
+            EntityId_T number = EntityIndex(pending);
+            if (number >= mReserved.load(memory_order_relaxed)) return NULL_ENTITY;
+            if (number >= mReservedIds.size()) {
+                mReservedIds.resize(number + 1, NULL_ENTITY);
+            }
+            if (mReservedIds[number] == NULL_ENTITY) {
+                mReservedIds[number] = CreateEntity();
+            }
+            return mReservedIds[number];
+        }
+
+        // pending handles to their entity, NULL_ENTITY before CreateReserved(),
+        // any other handle as is
+        EntityId_T Resolve(EntityId_T entity) const {
+            if (!IsReserved(entity)) return entity;
+            EntityId_T number = EntityIndex(entity);
+            return number < mReservedIds.size() ? mReservedIds[number] : NULL_ENTITY;
+        }
+
+        // forget every pending handle, the ones never created are dropped
+        void ClearReserved() {
+            mReserved.store(0, memory_order_relaxed);
+            mReservedIds.clear();
+        }
+
+        // reserve count ids at once, freed ids first then a fresh range
+        void CreateEntities(size_t count, EntityId_T* out) {
+            size_t i = 0;
+            for (; i < count && mFreeHead != FREE_END; ++i) {
+                out[i] = NextEntity();
+            }
+
+            o_assert_dbg(count - i < FREE_END - mNextEntity && "Max Entity Reached");
+            EntityId_T first = mNextEntity;
+            mNextEntity += (EntityId_T)(count - i);
+            mSlots.AssureRange(first, mNextEntity);
+            mSignatures.AssureRange(first, mNextEntity);
+            for (EntityId_T index = first; index < mNextEntity; ++index) {
+                mSlots[index] = index;
+                Touch(index);
+                out[i++] = index;
+            }
+
+            for (i = 0; i < count; ++i) {
+                mSignatures[EntityIndex(out[i])].reset();
+            }
+            mEntityCount += (EntityId_T)count;
+        }
+
+        // stale handles are skipped, so is a repeat of a handle destroyed earlier in the batch
+        void DestroyEntities(const EntityId_T* entities, size_t count) {
+            for (size_t i = 0; i < count; ++i) {
+                if (IsAlive(entities[i])) DestroyEntity(entities[i]);
+            }
+        }
+
+        // valid in release builds, stale handles return false
+        bool IsAlive(EntityId_T entity) const {
+            return mSlots.Get(EntityIndex(entity)) == entity;
+        }
+
+        Signature_T GetSignature(EntityId_T entity) const{
+            o_assert_dbg(IsAlive(entity) && "entity not in use");
+
+            return mSignatures[EntityIndex(entity)];
+        }
+
+        void SetSignature(EntityId_T entity, Signature_T signature) {
+            o_assert_dbg(IsAlive(entity) && "entity not in use");
+
+            mSignatures[EntityIndex(entity)] = signature;
+            Touch(EntityIndex(entity));
+        }
+
+        EntityId_T Size() const { return mEntityCount; }
+
+        // fn(entity, signature) for every live entity, by index
+        template <typename Func>
+        void ForEach(Func&& fn) const {
+            for (EntityId_T index = 0; index < mNextEntity; ++index) {
+                EntityId_T slot = mSlots[index];
+                // a free slot holds the next free index, never its own
+                if (EntityIndex(slot) == index) fn(slot, mSignatures[index]);
+            }
+        }
+
+        // slots written since the last TakePatch(), by value
+        struct Patch {
+            vector<EntityId_T> indices;
+            vector<EntityId_T> slots;
+            vector<Signature_T> signatures;
+            EntityId_T entityCount = 0;
+            EntityId_T nextEntity = 0;
+            EntityId_T freeHead = 0;
+        };
+
+        // record written slots for TakePatch(), off by default and in copies
+        void Track(bool track) {
+            mTrack = track;
+            mTouched.clear();
+        }
+
+        Patch TakePatch() {
+            sort(mTouched.begin(), mTouched.end());
+            mTouched.erase(unique(mTouched.begin(), mTouched.end()), mTouched.end());
+            Patch patch;
+            patch.indices.swap(mTouched);
+            for (auto index : patch.indices) {
+                patch.slots.push_back(mSlots[index]);
+                patch.signatures.push_back(mSignatures[index]);
+            }
+            patch.entityCount = mEntityCount;
+            patch.nextEntity = mNextEntity;
+            patch.freeHead = mFreeHead;
+            return patch;
+        }
+
+        // onto the state the patch was taken after
+        void ApplyPatch(Patch const& patch) {
+            for (size_t i = 0; i < patch.indices.size(); ++i) {
+                mSlots.Assure(patch.indices[i]) = patch.slots[i];
+                mSignatures.Assure(patch.indices[i]) = patch.signatures[i];
+            }
+            mEntityCount = patch.entityCount;
+            mNextEntity = patch.nextEntity;
+            mFreeHead = patch.freeHead;
+        }
+
+    private:
+        // end of the free list, an index never handed out
+        static const EntityId_T FREE_END = ENTITY_INDEX_MASK;
+        // never-used slot, index 0 with the last generation
+        static const EntityId_T UNUSED = ~ENTITY_INDEX_MASK;
+
+        // live handle, or next free index + next generation
+        PagedArray<EntityId_T> mSlots;
+        // component list
+        PagedArray<Signature_T> mSignatures;
+        EntityId_T mEntityCount;
+        // first never-used index
+        EntityId_T mNextEntity;
+        EntityId_T mFreeHead;
+        // pending handles handed out, and the entity each one got
+        atomic<EntityId_T> mReserved;
+        vector<EntityId_T> mReservedIds;
+        // slot indices written while tracked, see TakePatch()
+        bool mTrack = false;
+        vector<EntityId_T> mTouched;
+
+        void Touch(EntityId_T index) {
+            if (mTrack) mTouched.push_back(index);
+        }
+
+        // pop the most recently freed slot, otherwise grow into a fresh one
+        EntityId_T NextEntity() {
+            EntityId_T entity;
+            if (mFreeHead != FREE_END) {
+                EntityId_T index = mFreeHead;
+                EntityId_T slot = mSlots[index];
+                mFreeHead = EntityIndex(slot);
+                entity = MakeEntity(index, EntityGeneration(slot));
+            } else {
+                o_assert_dbg(mNextEntity < FREE_END && "Max Entity Reached");
+                entity = mNextEntity++;
+                mSlots.Assure(entity);
+                mSignatures.Assure(entity);
+            }
+            mSlots[EntityIndex(entity)] = entity;
+            Touch(EntityIndex(entity));
+            return entity;
+        }
+};
+
+
+// ecs_component.h
+//----------------------------------------------------------------
+/*
+IComponentPatch:
+    dense slots of one ComponentArray saved by value with their change
+    ticks, see IComponentArray::SaveChanged()
+*/
+class IComponentPatch {
+    public:
+        virtual ~IComponentPatch() = default;
+        virtual size_t Size() const = 0;
+};
+
+/*
+IComponentArray:
+    Tow designs on clean up.
+    A: EttManager.GetSignature() 
+        => ComponentManager.RemoveComponent(entity, typeid) for all typeid
+    B: ComponentManager.OnEntityDestroy()
+        => ComponentArray<T>.OnEntityDestroy() for all T
+*/
+class IComponentArray {
+    
+
+    public:
+        IComponentArray() {
+            mTick = 1;
+            mVersion = 0;
+            mRecordAdded = false;
+            mRecordRemoved = false;
+        }
+        virtual ~IComponentArray() = default;
+
+        // stamped on adds and mutable access, see ComponentManager::SetTick
+        void SetTick(uint32_t tick) { mTick = tick; }
+        uint32_t Tick() const { return mTick; }
+
+        // event streams, entities are appended only while recorded
+        void SetObserved(bool added, bool removed) {
+            mRecordAdded = added;
+            mRecordRemoved = removed;
+        }
+        vector<EntityId_T>& AddedEvents() { return mAddedEvents; }
+        vector<EntityId_T>& RemovedEvents() { return mRemovedEvents; }
+
+        // bumped by every add, remove and compaction. Equal versions
+        // mean the same entity at every dense id
+        uint32_t Version() const { return mVersion; }
+
+        virtual void RemoveComponent(EntityId_T entity) = 0;
+        // one virtual call per batch instead of per entity
+        virtual void RemoveComponents(const EntityId_T* entities, size_t count) = 0;
+        virtual bool HasComponent(EntityId_T entity) const = 0;
+        // close the holes of pointer-stable storage
+        virtual void Compact() = 0;
+        // deep copy, same policy, ticks and pending events
+        virtual unique_ptr<IComponentArray> Clone() const = 0;
+        // slots changed at or after tick since, by value
+        virtual unique_ptr<IComponentPatch> SaveChanged(uint32_t since) const = 0;
+        // write back a patch saved at the same Version()
+        virtual void ApplyPatch(IComponentPatch const& patch) = 0;
+
+    protected:
+        uint32_t mTick;
+        uint32_t mVersion;
+        bool mRecordAdded;
+        bool mRecordRemoved;
+        vector<EntityId_T> mAddedEvents;
+        vector<EntityId_T> mRemovedEvents;
+};
+
+/*
+ComponentArray<T>:
+    maintain components of type T. Know relative eneity ids
+    sparse (entity -> id) and dense (id -> data/entity) are both paged,
+    pages are allocated as entities/components show up.
+    Dense data is raw storage, only [0, mSize) is constructed.
+
+    The Storage policy picked at registration swaps the sparse index
+    (paged, flat, hash map) and can box the data. Both are runtime
+    switches inside this one final class, so the managers and View keep
+    calling it directly and the default path stays free of virtuals.
+
+    Change tracking: every dense slot keeps the tick it was added at and
+    the tick of its last mutable access (non-const GetComponent/
+    TryGetComponent, mutable View access). Each dense page keeps the
+    newest of its slots' ticks, so Changed/Added filters skip pages
+    nothing touched without looking at their slots.
+*/
+template <typename T>
+class ComponentArray final : public IComponentArray {
+    public:
+        explicit ComponentArray(Storage::Index index = Storage::PAGED_INDEX, bool boxed = false, bool stable = false)
+            : mEntity2Id(MAX_ENTITY), mAddedTicks(0), mChangedTicks(0) {
+            o_assert_dbg(!(boxed && stable) && "boxed data is pointer stable already");
+            mSize = 0;
+            mCount = 0;
+            mIndex = index;
+            mBoxed = boxed;
+            mStable = stable;
+        }
+
+        ~ComponentArray() {
+            for (EntityId_T id = 0; id < mSize; ++id) {
+                if (!mStable || Occupied(id)) At(id).~T();
+            }
+        }
+
+        ComponentArray(ComponentArray const&) = delete;
+        void operator=(ComponentArray const&) = delete;
+
+        void AddComponent(EntityId_T entity, T component) {
+            EmplaceComponent(entity, move(component));
+        }
+
+        // construct T(args...) directly in its dense slot
+        template <typename... Args>
+        T& EmplaceComponent(EntityId_T entity, Args&&... args) {
+            o_assert_dbg(SparseGet(EntityIndex(entity)) == MAX_ENTITY && "entity exist");
+
+            // attach to last, stable storage refills the newest hole first
+            EntityId_T id = mSize;
+            if (!mFree.empty()) {
+                id = mFree.back();
+                mFree.pop_back();
+            }
+            T* data;
+            if (mBoxed) {
+                mBoxes.emplace_back();
+                data = new (mBoxes.back().Allocate()) T(forward<Args>(args)...);
+            } else {
+                data = new (mDataArray.Assure(id)) T(forward<Args>(args)...);
+            }
+            // set id
+            SparseSet(EntityIndex(entity), id);
+            // set entity
+            mId2Entity.Assure(id) = entity;
+            // stamp ticks
+            mAddedTicks.Assure(id) = mTick;
+            mChangedTicks.Assure(id) = mTick;
+            if (id / ENTITY_PAGE_SIZE == mPageTicks.size()) {
+                mPageTicks.emplace_back();
+            }
+            PageTicks &page = mPageTicks[id / ENTITY_PAGE_SIZE];
+            page.added.store(mTick, memory_order_relaxed);
+            page.changed.store(mTick, memory_order_relaxed);
+            if (mStable) SetOccupied(id, true);
+            if (mRecordAdded) mAddedEvents.push_back(entity);
+
+            if (id == mSize) mSize++;
+            mCount++;
+            mVersion++;
+            return *data;
+        }
+
+        void RemoveComponent(EntityId_T entity) override {
+            o_assert_dbg(HasComponent(entity) && "entity not exist");
+
+            mCount--;
+            mVersion++;
+            EntityId_T gapId = SparseGet(EntityIndex(entity));
+            At(gapId).~T();
+            // init removed entity id
+            SparseErase(EntityIndex(entity));
+            if (mStable) {
+                // leave a tombstone, nothing else moves
+                SetOccupied(gapId, false);
+                mFree.push_back(gapId);
+            } else {
+                // relocate last data into the gap
+                mSize--;
+                if (gapId != mSize) MoveSlot(gapId, mSize);
+                if (mBoxed) mBoxes.pop_back();
+            }
+            if (mRecordRemoved) mRemovedEvents.push_back(entity);
+        }
+
+        /*
+            stable storage: fill the tombstones with the last live slots
+            and shrink Size() to Count(). Moves components, call it where
+            nobody holds pointers into the array. No-op for the others.
+        */
+        void Compact() override {
+            if (mFree.empty()) return;
+
+            mVersion++;
+            sort(mFree.begin(), mFree.end());
+            for (EntityId_T hole : mFree) {
+                while (mSize > 0 && !Occupied(mSize - 1)) mSize--;
+                if (hole >= mSize) break;
+                mSize--;
+                MoveSlot(hole, mSize);
+            }
+            while (mSize > 0 && !Occupied(mSize - 1)) mSize--;
+            mFree.clear();
+        }
+
+        /*
+            swap-remove a batch: destroy every removed T, then fill the
+            gaps below the new Size() with the live tail, one
+            RelocateRange per run of gaps and sources that are
+            contiguous on their pages. Entities must be distinct.
+        */
+        void RemoveComponents(const EntityId_T* entities, size_t count) override {
+            if (mStable || count < 2) {
+                for (size_t i = 0; i < count; ++i) {
+                    ComponentArray::RemoveComponent(entities[i]);
+                }
+                return;
+            }
+
+            mGaps.clear();
+            for (size_t i = 0; i < count; ++i) {
+                o_assert_dbg(HasComponent(entities[i]) && "entity not exist");
+                EntityId_T id = SparseGet(EntityIndex(entities[i]));
+                At(id).~T();
+                SparseErase(EntityIndex(entities[i]));
+                mGaps.push_back(id);
+                if (mRecordRemoved) mRemovedEvents.push_back(entities[i]);
+            }
+            sort(mGaps.begin(), mGaps.end());
+
+            EntityId_T size = mSize - (EntityId_T)count;
+            // gaps at or past size are dropped, the rest take the tail in order
+            size_t low = lower_bound(mGaps.begin(), mGaps.end(), size) - mGaps.begin();
+            // live ids in [size, mSize), skipping the gaps up there
+            size_t high = low;
+            EntityId_T src = size;
+            auto peekSource = [&] {
+                while (high < mGaps.size() && mGaps[high] == src) {
+                    high++;
+                    src++;
+                }
+                return src;
+            };
+            for (size_t g = 0; g < low;) {
+                EntityId_T dst = mGaps[g++];
+                EntityId_T first = peekSource();
+                EntityId_T run = 1;
+                src++;
+                // extend while both sides stay contiguous and on their page
+                while (g < low && mGaps[g] == dst + run
+                    && (dst + run) % ENTITY_PAGE_SIZE != 0 && (first + run) % ENTITY_PAGE_SIZE != 0
+                    && peekSource() == first + run) {
+                    g++;
+                    run++;
+                    src++;
+                }
+                MoveRange(dst, first, run);
+            }
+
+            if (mBoxed) mBoxes.resize(size);
+            mSize = size;
+            mCount -= (EntityId_T)count;
+            mVersion++;
+        }
+
+        /*
+            page by page, one memcpy per page for trivially copyable T,
+            copy construction per live slot otherwise. T must be copy
+            constructible.
+        */
+        unique_ptr<IComponentArray> Clone() const override {
+            auto copy = make_unique<ComponentArray>(mIndex, mBoxed, mStable);
+            copy->CopyFrom(*this, integral_constant<bool, is_copy_constructible<T>::value>());
+            return copy;
+        }
+
+        // pages older than since are skipped whole
+        unique_ptr<IComponentPatch> SaveChanged(uint32_t since) const override {
+            auto patch = make_unique<Patch>();
+            SaveChanged(*patch, since, integral_constant<bool, is_copy_constructible<T>::value>());
+            return patch;
+        }
+
+        void ApplyPatch(IComponentPatch const& base) override {
+            ApplyPatch(static_cast<Patch const&>(base), integral_constant<bool, is_copy_constructible<T>::value>());
+        }
+
+        // mutable access, marks the component changed
+        T& GetComponent(EntityId_T entity) {
+            o_assert_dbg(HasComponent(entity) && "entity not exist");
+
+            EntityId_T id = SparseGet(EntityIndex(entity));
+            MarkChanged(id);
+            return At(id);
+        }
+
+        T const& GetComponent(EntityId_T entity) const {
+            o_assert_dbg(HasComponent(entity) && "entity not exist");
+
+            return At(SparseGet(EntityIndex(entity)));
+        }
+
+        // nullptr if entity has no T, stale handles included
+        T* TryGetComponent(EntityId_T entity) {
+            EntityId_T id = Find(entity);
+            if (id == MAX_ENTITY) return nullptr;
+            MarkChanged(id);
+            return &At(id);
+        }
+
+        T const* TryGetComponent(EntityId_T entity) const {
+            EntityId_T id = Find(entity);
+            return id != MAX_ENTITY ? &At(id) : nullptr;
+        }
+
+        // dense id of entity's T, MAX_ENTITY if none
+        EntityId_T Find(EntityId_T entity) const {
+            EntityId_T id = SparseGet(EntityIndex(entity));
+            return id < mSize && mId2Entity[id] == entity ? id : MAX_ENTITY;
+        }
+
+        // by dense id, no change mark
+        T& At(EntityId_T id) { return mBoxed ? *mBoxes[id].data : mDataArray[id]; }
+        T const& At(EntityId_T id) const { return mBoxed ? *mBoxes[id].data : mDataArray[id]; }
+        uint32_t AddedTickAt(EntityId_T id) const { return mAddedTicks[id]; }
+        uint32_t ChangedTickAt(EntityId_T id) const { return mChangedTicks[id]; }
+
+        // tick entity's T was added / last changed at, 0 without a T
+        uint32_t AddedTick(EntityId_T entity) const {
+            EntityId_T id = Find(entity);
+            return id != MAX_ENTITY ? mAddedTicks[id] : 0;
+        }
+
+        uint32_t ChangedTick(EntityId_T entity) const {
+            EntityId_T id = Find(entity);
+            return id != MAX_ENTITY ? mChangedTicks[id] : 0;
+        }
+
+        // stamp dense id with the current tick, safe for distinct ids in parallel
+        void MarkChanged(EntityId_T id) {
+            mChangedTicks[id] = mTick;
+            auto &page = mPageTicks[id / ENTITY_PAGE_SIZE].changed;
+            if (page.load(memory_order_relaxed) != mTick) {
+                page.store(mTick, memory_order_relaxed);
+            }
+        }
+
+        bool HasComponent(EntityId_T entity) const override {
+            return Find(entity) != MAX_ENTITY;
+        }
+
+        // dense access, id in [0, Size()), stable storage may have holes
+        EntityId_T* EntityPage(EntityId_T id) { return mId2Entity.PageData(id); }
+        // nullptr when boxed, data is not contiguous then, use At()
+        T* DataPage(EntityId_T id) { return mBoxed ? nullptr : mDataArray.PageData(id); }
+        // newest tick on the dense page holding id
+        uint32_t PageAddedTick(EntityId_T id) const { return mPageTicks[id / ENTITY_PAGE_SIZE].added.load(memory_order_relaxed); }
+        uint32_t PageChangedTick(EntityId_T id) const { return mPageTicks[id / ENTITY_PAGE_SIZE].changed.load(memory_order_relaxed); }
+
+        // end of the dense range
+        EntityId_T Size() const {
+            return mSize;
+        }
+
+        // live components, Size() minus the holes
+        EntityId_T Count() const { return mCount; }
+
+        Storage::Index IndexKind() const { return mIndex; }
+        bool Boxed() const { return mBoxed; }
+        bool Stable() const { return mStable; }
+
+        // stable storage only, false for a hole
+        bool Occupied(EntityId_T id) const { return (mOccupied[id / 64] >> (id % 64)) & 1; }
+
+    private:
+        EntityId_T mSize;
+        EntityId_T mCount;
+        Storage::Index mIndex;
+        bool mBoxed;
+        bool mStable;
+
+        // stable storage: one bit per dense id, holes to refill
+        vector<uint64_t> mOccupied;
+        vector<EntityId_T> mFree;
+        // scratch for RemoveComponents, removed dense ids
+        vector<EntityId_T> mGaps;
+
+        PagedStorage<T> mDataArray;
+        // boxed data, dense id -> own aligned allocation
+        struct Box {
+            unique_ptr<unsigned char[]> raw;
+            T* data;
+
+            void* Allocate() {
+                size_t bytes = sizeof(T) + alignof(T);
+                raw.reset(new unsigned char[bytes]);
+                void* ptr = raw.get();
+                data = static_cast<T*>(align(alignof(T), sizeof(T), ptr, bytes));
+                return data;
+            }
+        };
+        vector<Box> mBoxes;
+        // sparse index, one of these by mIndex
+        PagedArray<EntityId_T> mEntity2Id;
+        vector<EntityId_T> mFlat;
+        EntityHashMap mHashed;
+        PagedArray<EntityId_T> mId2Entity;
+        // dense id -> tick
+        PagedArray<uint32_t> mAddedTicks;
+        PagedArray<uint32_t> mChangedTicks;
+
+        // upper bound of a dense page's slot ticks, never lowered.
+        // atomic as parallel walks mark the same page
+        struct PageTicks {
+            atomic<uint32_t> added{0};
+            atomic<uint32_t> changed{0};
+        };
+        // deque, grows without moving the atomics
+        deque<PageTicks> mPageTicks;
+
+        static void Raise(atomic<uint32_t> &tick, uint32_t value) {
+            if (tick.load(memory_order_relaxed) < value) {
+                tick.store(value, memory_order_relaxed);
+            }
+        }
+
+        struct Patch : IComponentPatch {
+            vector<EntityId_T> ids;
+            vector<uint32_t> ticks;
+            vector<T> values;
+
+            size_t Size() const override { return ids.size(); }
+        };
+
+        void SaveChanged(Patch& patch, uint32_t since, true_type) const {
+            for (EntityId_T base = 0; base < mSize; base += ENTITY_PAGE_SIZE) {
+                if (PageChangedTick(base) < since) continue;
+                EntityId_T end = min(base + ENTITY_PAGE_SIZE, mSize);
+                for (EntityId_T id = base; id < end; ++id) {
+                    if (mChangedTicks[id] < since || (mStable && !Occupied(id))) continue;
+                    patch.ids.push_back(id);
+                    patch.ticks.push_back(mChangedTicks[id]);
+                    patch.values.push_back(At(id));
+                }
+            }
+        }
+
+        void SaveChanged(Patch&, uint32_t, false_type) const {
+            o_assert_dbg(mCount == 0 && "component type is not copyable");
+        }
+
+        void ApplyPatch(Patch const& patch, true_type) {
+            for (size_t i = 0; i < patch.ids.size(); ++i) {
+                EntityId_T id = patch.ids[i];
+                T* slot = &At(id);
+                slot->~T();
+                new (slot) T(patch.values[i]);
+                mChangedTicks[id] = patch.ticks[i];
+                Raise(mPageTicks[id / ENTITY_PAGE_SIZE].changed, patch.ticks[i]);
+            }
+        }
+
+        void ApplyPatch(Patch const&, false_type) {}
+
+        void CopyFrom(ComponentArray const& other, false_type) {
+            o_assert_dbg(other.mCount == 0 && "component type is not copyable");
+            (void)other;
+        }
+
+        void CopyFrom(ComponentArray const& other, true_type) {
+            mTick = other.mTick;
+            mVersion = other.mVersion;
+            mRecordAdded = other.mRecordAdded;
+            mRecordRemoved = other.mRecordRemoved;
+            mAddedEvents = other.mAddedEvents;
+            mRemovedEvents = other.mRemovedEvents;
+
+            mSize = other.mSize;
+            mCount = other.mCount;
+            mOccupied = other.mOccupied;
+            mFree = other.mFree;
+            mEntity2Id = other.mEntity2Id;
+            mFlat = other.mFlat;
+            mHashed = other.mHashed;
+            mId2Entity = other.mId2Entity;
+            mAddedTicks = other.mAddedTicks;
+            mChangedTicks = other.mChangedTicks;
+            for (auto const &page : other.mPageTicks) {
+                mPageTicks.emplace_back();
+                mPageTicks.back().added.store(page.added.load(memory_order_relaxed), memory_order_relaxed);
+                mPageTicks.back().changed.store(page.changed.load(memory_order_relaxed), memory_order_relaxed);
+            }
+
+            if (mBoxed) {
+                for (EntityId_T id = 0; id < mSize; ++id) {
+                    mBoxes.emplace_back();
+                    new (mBoxes.back().Allocate()) T(*other.mBoxes[id].data);
+                }
+            } else {
+                CopyData(other, integral_constant<bool, is_trivially_copyable<T>::value>());
+            }
+        }
+
+        // holes are copied as raw bytes too, nobody reads them
+        void CopyData(ComponentArray const& other, true_type) {
+            for (EntityId_T base = 0; base < mSize; base += ENTITY_PAGE_SIZE) {
+                EntityId_T count = min(ENTITY_PAGE_SIZE, mSize - base);
+                memcpy(static_cast<void*>(mDataArray.Assure(base)), static_cast<const void*>(other.mDataArray.Slot(base)), sizeof(T) * count);
+            }
+        }
+
+        void CopyData(ComponentArray const& other, false_type) {
+            for (EntityId_T id = 0; id < mSize; ++id) {
+                T* slot = mDataArray.Assure(id);
+                if (!mStable || Occupied(id)) new (slot) T(other.mDataArray[id]);
+            }
+        }
+
+        void SetOccupied(EntityId_T id, bool occupied) {
+            if (id / 64 >= mOccupied.size()) mOccupied.resize(id / 64 + 1, 0);
+            uint64_t bit = uint64_t(1) << (id % 64);
+            mOccupied[id / 64] = occupied ? mOccupied[id / 64] | bit : mOccupied[id / 64] & ~bit;
+        }
+
+        // relocate the live slot src into the empty slot dst, ticks and index follow
+        void MoveSlot(EntityId_T dst, EntityId_T src) {
+            MoveRange(dst, src, 1);
+        }
+
+        // MoveSlot for count slots, both ranges inside one page each
+        void MoveRange(EntityId_T dst, EntityId_T src, EntityId_T count) {
+            if (mBoxed) {
+                for (EntityId_T i = 0; i < count; ++i) {
+                    mBoxes[dst + i] = move(mBoxes[src + i]);
+                }
+            } else {
+                RelocateRange(mDataArray.Slot(dst), mDataArray.Slot(src), count);
+            }
+            for (EntityId_T i = 0; i < count; ++i) {
+                // the dst page may get newer ticks
+                mAddedTicks[dst + i] = mAddedTicks[src + i];
+                mChangedTicks[dst + i] = mChangedTicks[src + i];
+                PageTicks &page = mPageTicks[(dst + i) / ENTITY_PAGE_SIZE];
+                Raise(page.added, mAddedTicks[dst + i]);
+                Raise(page.changed, mChangedTicks[dst + i]);
+                mId2Entity[dst + i] = mId2Entity[src + i];
+                SparseSet(EntityIndex(mId2Entity[dst + i]), dst + i);
+                if (mStable) {
+                    SetOccupied(dst + i, true);
+                    SetOccupied(src + i, false);
+                }
+            }
+        }
+
+        // entity index -> dense id, MAX_ENTITY if none
+        EntityId_T SparseGet(EntityId_T index) const {
+            switch (mIndex) {
+                case Storage::FLAT_INDEX: return index < mFlat.size() ? mFlat[index] : MAX_ENTITY;
+                case Storage::HASH_INDEX: return mHashed.Get(index);
+                default: return mEntity2Id.Get(index);
+            }
+        }
+
+        void SparseSet(EntityId_T index, EntityId_T id) {
+            switch (mIndex) {
+                case Storage::FLAT_INDEX:
+                    if (index >= mFlat.size()) mFlat.resize(index + 1, MAX_ENTITY);
+                    mFlat[index] = id;
+                    break;
+                case Storage::HASH_INDEX: mHashed.Set(index, id); break;
+                default: mEntity2Id.Assure(index) = id; break;
+            }
+        }
+
+        void SparseErase(EntityId_T index) {
+            switch (mIndex) {
+                case Storage::FLAT_INDEX: mFlat[index] = MAX_ENTITY; break;
+                case Storage::HASH_INDEX: mHashed.Erase(index); break;
+                default: mEntity2Id[index] = MAX_ENTITY; break;
+            }
+        }
+};
+
+
+/*
+ComponentManager:
+    maintain ComponentArray with different type
+
+    index ComponentArray<T> directly by ComponentTypeId<T>()
+    tags (IsTag<T>) get no array, adding/removing one only returns its
+    bit for the caller to flip in the signature. The caller reports the
+    flip through OnTagsChanged(), which keeps the tag's event streams.
+*/
+class ComponentManager {
+    public:
+        ComponentManager() {
+            mSize = 0;
+            mTick = 1;
+        }
+
+        // Policy is one of Storage::Paged/Dense/Hash/Boxed/Stable, ignored for tags
+        template <typename T, typename Policy = Storage::Paged>
+        void RegisterComponent() {
+            ComponentId_T id = ComponentTypeId<T>();
+            o_assert_dbg(!mId2Array[id] && !mTags[id] && "Component Registered");
+
+            if (IsTag<T>::value) {
+                mTags.set(id, true);
+            } else {
+                // copies, the policy constants have no out of line definition
+                Storage::Index index = Policy::index;
+                bool boxed = Policy::boxed;
+                bool stable = Policy::stable;
+                mId2Array[id] = make_unique<ComponentArray<T>>(index, boxed, stable);
+                mId2Array[id]->SetTick(mTick);
+                mId2Array[id]->SetObserved(mObserveAdded[id], mObserveRemoved[id]);
+            }
+
+            mSize++;
+        }
+
+        template <typename T>
+        ComponentId_T AddComponent(EntityId_T entity, T component) {
+            ComponentId_T id = ComponentTypeId<T>();
+            if (!IsTag<T>::value) {
+                GetArray<T>()->EmplaceComponent(entity, move(component));
+            }
+
+            return id;
+        }
+
+        template <typename T, typename... Args>
+        ComponentId_T EmplaceComponent(EntityId_T entity, Args&&... args) {
+            ComponentId_T id = ComponentTypeId<T>();
+            if (!IsTag<T>::value) {
+                GetArray<T>()->EmplaceComponent(entity, forward<Args>(args)...);
+            }
+
+            return id;
+        }
+        
+        template <typename T>
+        ComponentId_T RemoveComponent(EntityId_T entity) {
+            ComponentId_T id = ComponentTypeId<T>();
+            if (!IsTag<T>::value) {
+                GetArray<T>()->RemoveComponent(entity);
+            }
+
+            return id;
+        }
+
+        void RemoveAllComponents(EntityId_T entity, Signature_T const &signature) {
+            ForEachSetBit(signature & ~mTags, [&](size_t i) {
+                mId2Array[i]->RemoveComponent(entity);
+            });
+            OnTagsChanged(entity, signature, Signature_T());
+        }
+
+        // bucket entities per ComponentArray, then remove array by array
+        void RemoveAllComponents(const EntityId_T* entities, const Signature_T* signatures, size_t count) {
+            Signature_T touched;
+            for (size_t e = 0; e < count; ++e) {
+                Signature_T stored = signatures[e] & ~mTags;
+                ForEachSetBit(stored, [&](size_t i) {
+                    mBuckets[i].push_back(entities[e]);
+                });
+                touched |= stored;
+                OnTagsChanged(entities[e], signatures[e], Signature_T());
+            }
+            ForEachSetBit(touched, [&](size_t i) {
+                mId2Array[i]->RemoveComponents(mBuckets[i].data(), mBuckets[i].size());
+                mBuckets[i].clear();
+            });
+        }
+
+        // tags hand out one shared instance
+        template <typename T>
+        T& GetComponent(EntityId_T entity) {
+            return GetComponent<T>(entity, IsTag<T>());
+        }
+
+        // no change mark
+        template <typename T>
+        T const& ReadComponent(EntityId_T entity) const {
+            return ReadComponent<T>(entity, IsTag<T>());
+        }
+
+        bool IsTagId(ComponentId_T id) const { return mTags[id]; }
+
+        // record add/remove events for the observed tag bits that differ
+        void OnTagsChanged(EntityId_T entity, Signature_T const &before, Signature_T const &after) {
+            Signature_T flipped = (before ^ after) & mTags & (mObserveAdded | mObserveRemoved);
+            ForEachSetBit(flipped, [&](size_t i) {
+                if (after[i]) {
+                    if (mObserveAdded[i]) mTagAdded[i].push_back(entity);
+                } else if (mObserveRemoved[i]) {
+                    mTagRemoved[i].push_back(entity);
+                }
+            });
+        }
+
+        // event streams of id, array or tag
+        vector<EntityId_T>& AddedEvents(ComponentId_T id) {
+            return mId2Array[id] ? mId2Array[id]->AddedEvents() : mTagAdded[id];
+        }
+
+        vector<EntityId_T>& RemovedEvents(ComponentId_T id) {
+            return mId2Array[id] ? mId2Array[id]->RemovedEvents() : mTagRemoved[id];
+        }
+
+        template <typename T>
+        ComponentArray<T>* GetArray() const {
+            ComponentId_T id = ComponentTypeId<T>();
+            o_assert_dbg(mId2Array[id] && "Component Not Registered");
+
+            return static_cast<ComponentArray<T>*>(mId2Array[id].get());
+        }
+
+        ComponentId_T Size() const { return mSize; }
+
+        // tick stamped by adds and mutable access from now on
+        void SetTick(uint32_t tick) {
+            mTick = tick;
+            for (auto &array : mId2Array) {
+                if (array) array->SetTick(tick);
+            }
+        }
+
+        uint32_t Tick() const { return mTick; }
+
+        // every array cloned, see ComponentArray::Clone()
+        unique_ptr<ComponentManager> Clone() const {
+            auto copy = make_unique<ComponentManager>();
+            copy->mSize = mSize;
+            copy->mTick = mTick;
+            copy->mTags = mTags;
+            copy->mObserveAdded = mObserveAdded;
+            copy->mObserveRemoved = mObserveRemoved;
+            for (size_t id = 0; id < MAX_COMPONENT; ++id) {
+                if (mId2Array[id]) copy->mId2Array[id] = mId2Array[id]->Clone();
+            }
+            ForEachSetBit(mTags, [&](size_t id) {
+                copy->mTagAdded[id] = mTagAdded[id];
+                copy->mTagRemoved[id] = mTagRemoved[id];
+            });
+            return copy;
+        }
+
+        // swap in a saved array of a registered type, takes the current tick
+        void RestoreArray(ComponentId_T id, unique_ptr<IComponentArray> array) {
+            o_assert_dbg(mId2Array[id] && "Component Not Registered");
+
+            mId2Array[id] = move(array);
+            mId2Array[id]->SetTick(mTick);
+            mId2Array[id]->SetObserved(mObserveAdded[id], mObserveRemoved[id]);
+        }
+
+        // close the holes of every pointer-stable array
+        void Compact() {
+            for (auto &array : mId2Array) {
+                if (array) array->Compact();
+            }
+        }
+
+        // record add/remove events of these types, later registrations too
+        void Observe(Signature_T const &added, Signature_T const &removed) {
+            mObserveAdded |= added;
+            mObserveRemoved |= removed;
+            ForEachSetBit(mObserveAdded | mObserveRemoved, [&](size_t i) {
+                if (mId2Array[i]) mId2Array[i]->SetObserved(mObserveAdded[i], mObserveRemoved[i]);
+            });
+        }
+
+        // nullptr if not registered
+        IComponentArray* GetArray(ComponentId_T id) const { return mId2Array[id].get(); }
+        
+        template <typename T>
+        ComponentId_T GetComponentId() const {
+            ComponentId_T id = ComponentTypeId<T>();
+            o_assert_dbg((mId2Array[id] || mTags[id]) && "Component Not Registered");
+
+            return id;
+        }
+
+    private:
+        ComponentId_T mSize;
+        uint32_t mTick;
+        // registered tags, no array behind these bits
+        Signature_T mTags;
+        Signature_T mObserveAdded;
+        Signature_T mObserveRemoved;
+        array<unique_ptr<IComponentArray>, MAX_COMPONENT> mId2Array;
+        // scratch for batched removal, keeps its capacity
+        array<vector<EntityId_T>, MAX_COMPONENT> mBuckets;
+        // event streams of tags, arrays keep their own
+        array<vector<EntityId_T>, MAX_COMPONENT> mTagAdded;
+        array<vector<EntityId_T>, MAX_COMPONENT> mTagRemoved;
+
+        template <typename T>
+        T& GetComponent(EntityId_T entity, false_type) {
+            return GetArray<T>()->GetComponent(entity);
+        }
+
+        template <typename T>
+        T& GetComponent(EntityId_T, true_type) {
+            static T tag;
+            return tag;
+        }
+
+        template <typename T>
+        T const& ReadComponent(EntityId_T entity, false_type) const {
+            auto const* array = GetArray<T>();
+            return array->GetComponent(entity);
+        }
+
+        template <typename T>
+        T const& ReadComponent(EntityId_T, true_type) const {
+            static const T tag{};
+            return tag;
+        }
+};
+
+
+// ecs_system.h
+// ----------------------------------------------------------------
+
+
+/*
+SystemManager
+    Maintain Systems and entites list in each system
+*/
+class SystemManager {
+    public:
+        SystemManager() {}
+
+        // world is handed to the system before OnSystemRegister()
+        template <typename T>
+        shared_ptr<T> RegisterSystem(World* world = nullptr) {
+            static_assert(std::is_base_of<System, T>::value, "T not derived from System");
+            size_t id = TypeIndex<SystemFamily>::Get<T>();
+            if (id >= mId2System.size()) {
+                mId2System.resize(id + 1);
+            }
+            o_assert_dbg(!mId2System[id] && "System Registered");
+
+            auto ptr = make_shared<T>();
+            ptr->mWorld = world;
+            ptr->OnSystemRegister();
+            Add(id, ptr, &CloneSystem<T>);
+            return ptr;
+        }
+
+        /*
+            same systems in the same order, each copied with its
+            signatures and entities, handed world instead. Copy
+            constructible systems are copied whole, others get a default
+            constructed T with the System part copied.
+        */
+        unique_ptr<SystemManager> Clone(World* world) const {
+            auto copy = make_unique<SystemManager>();
+            for (size_t i = 0; i < mSystems.size(); ++i) {
+                auto system = mCloners[i](*mSystems[i]);
+                system->mWorld = world;
+                copy->Add(mTypeIds[i], move(system), mCloners[i]);
+            }
+            copy->mSignatureEvents = mSignatureEvents;
+            return copy;
+        }
+
+        /*
+            run every system once. Without a pool (or workers) systems
+            run in registration order. With one, a system waits only for
+            earlier-registered systems it conflicts with, the rest run
+            concurrently on the pool.
+        */
+        // tick is handed to each system as mLastRunTick once it ran
+        void Update(ThreadPool* pool, uint32_t tick = 0) {
+            if (!pool || pool->WorkerCount() == 0) {
+                for (auto system : mSystems) {
+                    system->Update();
+                    system->mLastRunTick = tick;
+                }
+                return;
+            }
+
+            BuildSchedule();
+            size_t count = mSystems.size();
+            for (size_t i = 0; i < count; ++i) {
+                mPending[i].store(mDependencies[i], memory_order_relaxed);
+            }
+
+            // shared by the tasks, a worker may still be returning from
+            // the last one after this call is done
+            auto batch = make_shared<Batch>();
+            batch->manager = this;
+            batch->pool = pool;
+            batch->tick = tick;
+            batch->finished = 0;
+            for (size_t i = 0; i < count; ++i) {
+                if (mDependencies[i] == 0) {
+                    pool->Submit([batch, i] { Run(batch, i); }, batch.get());
+                }
+            }
+            pool->HelpUntil(batch.get(), [&] { return batch->finished.load(memory_order_acquire) == count; });
+        }
+
+        // true if a and b may not run at the same time
+        static bool Conflicts(System const &a, System const &b) {
+            bool aExclusive = a.mReads.none() && a.mWrites.none();
+            bool bExclusive = b.mReads.none() && b.mWrites.none();
+            return aExclusive || bExclusive
+                || (a.mWrites & (b.mReads | b.mWrites)).any()
+                || (b.mWrites & a.mReads).any();
+        }
+        
+
+        void OnEntityDestroy(EntityId_T entity, Signature_T const &signature) {
+            mMembershipVersion++;
+            if (mRecordSignatures) {
+                mSignatureEvents.push_back({entity, signature, Signature_T()});
+            }
+            // only systems sharing a bit can hold the entity
+            for (auto index : mMatchAll) {
+                mSystems[index]->mEntities.Erase(entity);
+            }
+            ForEachInterested(signature, [&](System* system) {
+                system->mEntities.Erase(entity);
+            });
+        }
+
+        /*
+            purge a batch of entities, one pass per affected system.
+            signature is the union of the batch's signatures
+        */
+        void OnEntitiesDestroy(const EntityId_T* entities, const Signature_T* signatures, size_t count,
+            Signature_T const &signature) {
+            mMembershipVersion++;
+            for (size_t i = 0; i < count; ++i) {
+                mDoomed.Insert(entities[i]);
+            }
+            if (mRecordSignatures) {
+                for (size_t i = 0; i < count; ++i) {
+                    mSignatureEvents.push_back({entities[i], signatures[i], Signature_T()});
+                }
+            }
+            auto purge = [&](System* system) {
+                if (count * 4 < system->mEntities.Size()) {
+                    for (size_t i = 0; i < count; ++i) {
+                        system->mEntities.Erase(entities[i]);
+                    }
+                } else {
+                    system->mEntities.EraseIf([&](EntityId_T entity) { return mDoomed.Contains(entity); });
+                }
+            };
+            for (auto index : mMatchAll) {
+                purge(mSystems[index]);
+            }
+            ForEachInterested(signature, purge);
+            mDoomed.Clear();
+        }
+
+        /*
+            re-test only the systems whose signature contains a bit that
+            differs between oldSignature and signature
+        */
+        void OnEntitySignatureUpdate(EntityId_T entity, Signature_T const &oldSignature, Signature_T const &signature) {
+            mMembershipVersion++;
+            if (mRecordSignatures) {
+                mSignatureEvents.push_back({entity, oldSignature, signature});
+            }
+            if (oldSignature.none()) {
+                for (auto index : mMatchAll) {
+                    if (Matches(*mSystems[index], signature)) {
+                        mSystems[index]->mEntities.Insert(entity);
+                    }
+                }
+            } else if (signature.none()) {
+                for (auto index : mMatchAll) {
+                    mSystems[index]->mEntities.Erase(entity);
+                }
+            }
+            ForEachInterested(oldSignature ^ signature, [&](System* system) {
+                if (Matches(*system, signature)) {
+                    system->mEntities.Insert(entity);
+                } else {
+                    system->mEntities.Erase(entity);
+                }
+            });
+        }
+
+        // has every required bit and no excluded one, empty signatures match nothing
+        static bool Matches(System const &system, Signature_T const &signature) {
+            return signature.any()
+                && (signature & system.mSignature) == system.mSignature
+                && (signature & system.mExclude).none();
+        }
+
+        // bumped by every call that may change a membership
+        uint32_t MembershipVersion() const { return mMembershipVersion; }
+
+        // every system's entities in iteration order, registration order
+        vector<vector<EntityId_T>> SaveMemberships() const {
+            vector<vector<EntityId_T>> members(mSystems.size());
+            for (size_t i = 0; i < mSystems.size(); ++i) {
+                members[i].assign(mSystems[i]->mEntities.begin(), mSystems[i]->mEntities.end());
+            }
+            return members;
+        }
+
+        vector<uint32_t> SaveLastRunTicks() const {
+            vector<uint32_t> ticks;
+            for (auto system : mSystems) {
+                ticks.push_back(system->mLastRunTick);
+            }
+            return ticks;
+        }
+
+        /*
+            put saved memberships and last run ticks back, e.g. on a
+            rollback, so systems iterate as they did then. Systems
+            registered since are refilled from the signatures in index
+            order and keep their tick. Pending signature events are
+            dropped.
+        */
+        void Restore(vector<vector<EntityId_T>> const &members, vector<uint32_t> const &lastRunTicks,
+            EntityManager const &entities) {
+            mMembershipVersion++;
+            mSignatureEvents.clear();
+            for (size_t i = 0; i < mSystems.size(); ++i) {
+                EntitySet &set = mSystems[i]->mEntities;
+                set.Clear();
+                if (i < members.size()) {
+                    for (auto entity : members[i]) set.Insert(entity);
+                    mSystems[i]->mLastRunTick = lastRunTicks[i];
+                } else {
+                    entities.ForEach([&](EntityId_T entity, Signature_T const &signature) {
+                        if (Matches(*mSystems[i], signature)) set.Insert(entity);
+                    });
+                }
+            }
+        }
+
+        template <typename T>
+        shared_ptr<T> GetSystem() {
+            size_t id = TypeIndex<SystemFamily>::Get<T>();
+            o_assert_dbg(id < mId2System.size() && mId2System[id] && "System Not Registerd");
+
+            return static_pointer_cast<T>(mId2System[id]);
+        }
+
+        size_t Size() const {
+            return mSystems.size();
+        }
+
+        // component types some system observes
+        Signature_T const& ObservedAdded() const { return mObserveAdded; }
+        Signature_T const& ObservedRemoved() const { return mObserveRemoved; }
+
+        /*
+            hand observers everything recorded since the last dispatch,
+            one call per system and type. The streams are swapped out
+            first, changes made by the handlers go to the next batch.
+        */
+        void DispatchEvents(ComponentManager &components) {
+            if (mObservers.empty()) return;
+
+            ForEachSetBit(mObserveAdded | mObserveRemoved, [&](size_t id) {
+                swap(mAddedBatch[id], components.AddedEvents((ComponentId_T)id));
+                swap(mRemovedBatch[id], components.RemovedEvents((ComponentId_T)id));
+            });
+            swap(mSignatureBatch, mSignatureEvents);
+
+            for (auto index : mObservers) {
+                System* system = mSystems[index];
+                ForEachSetBit(system->mObserveAdded, [&](size_t id) {
+                    auto &batch = mAddedBatch[id];
+                    if (!batch.empty()) system->OnComponentsAdded((ComponentId_T)id, batch.data(), batch.size());
+                });
+                ForEachSetBit(system->mObserveRemoved, [&](size_t id) {
+                    auto &batch = mRemovedBatch[id];
+                    if (!batch.empty()) system->OnComponentsRemoved((ComponentId_T)id, batch.data(), batch.size());
+                });
+                if (system->mObserveSignatures && !mSignatureBatch.empty()) {
+                    system->OnSignaturesChanged(mSignatureBatch.data(), mSignatureBatch.size());
+                }
+            }
+
+            ForEachSetBit(mObserveAdded | mObserveRemoved, [&](size_t id) {
+                mAddedBatch[id].clear();
+                mRemovedBatch[id].clear();
+            });
+            mSignatureBatch.clear();
+        }
+    private:
+        using Cloner = shared_ptr<System> (*)(System const&);
+
+        // registration order
+        vector<System*> mSystems;
+        // TypeIndex<SystemFamily> -> system
+        vector<shared_ptr<System>> mId2System;
+        // per system in registration order, for Clone()
+        vector<size_t> mTypeIds;
+        vector<Cloner> mCloners;
+        // component bit -> systems having it in their signature
+        array<vector<size_t>, MAX_COMPONENT> mInterest;
+        // systems with an empty signature
+        vector<size_t> mMatchAll;
+        // per system stamp, dedupes systems reached through several bits
+        vector<uint32_t> mVisited;
+        uint32_t mStamp = 0;
+        // scratch for OnEntitiesDestroy
+        EntitySet mDoomed;
+        uint32_t mMembershipVersion = 0;
+
+        // reactive systems and the events they want
+        vector<size_t> mObservers;
+        Signature_T mObserveAdded;
+        Signature_T mObserveRemoved;
+        bool mRecordSignatures = false;
+        vector<SignatureEvent> mSignatureEvents;
+        // batch being dispatched, keeps its capacity
+        array<vector<EntityId_T>, MAX_COMPONENT> mAddedBatch;
+        array<vector<EntityId_T>, MAX_COMPONENT> mRemovedBatch;
+        vector<SignatureEvent> mSignatureBatch;
+
+        // schedule DAG, edges point from earlier to later registered systems
+        vector<vector<size_t>> mSuccessors;
+        vector<uint32_t> mDependencies;
+        unique_ptr<atomic<uint32_t>[]> mPending;
+        bool mScheduleDirty = true;
+
+        // index by the signature set in OnSystemRegister
+        void Add(size_t id, shared_ptr<System> ptr, Cloner cloner) {
+            if (id >= mId2System.size()) {
+                mId2System.resize(id + 1);
+            }
+            size_t index = mSystems.size();
+            mSystems.push_back(ptr.get());
+            mTypeIds.push_back(id);
+            mCloners.push_back(cloner);
+            mVisited.push_back(0);
+            if (ptr->mSignature.none()) {
+                mMatchAll.push_back(index);
+            }
+            // excluded bits can flip membership too
+            ForEachSetBit(ptr->mSignature | ptr->mExclude, [&](size_t bit) {
+                mInterest[bit].push_back(index);
+            });
+            if (ptr->mObserveAdded.any() || ptr->mObserveRemoved.any() || ptr->mObserveSignatures) {
+                mObservers.push_back(index);
+                mObserveAdded |= ptr->mObserveAdded;
+                mObserveRemoved |= ptr->mObserveRemoved;
+                mRecordSignatures |= ptr->mObserveSignatures;
+            }
+            mId2System[id] = move(ptr);
+            mScheduleDirty = true;
+        }
+
+        // one parallel Update()
+        struct Batch {
+            SystemManager* manager;
+            ThreadPool* pool;
+            uint32_t tick;
+            atomic<size_t> finished;
+        };
+
+        // update system i, then submit the successors it was the last dependency of
+        static void Run(shared_ptr<Batch> const &batch, size_t i) {
+            SystemManager &self = *batch->manager;
+            self.mSystems[i]->Update();
+            self.mSystems[i]->mLastRunTick = batch->tick;
+            for (auto next : self.mSuccessors[i]) {
+                if (self.mPending[next].fetch_sub(1, memory_order_acq_rel) == 1) {
+                    batch->pool->Submit([batch, next] { Run(batch, next); }, batch.get());
+                }
+            }
+            batch->finished.fetch_add(1, memory_order_release);
+        }
+
+        template <typename T>
+        static shared_ptr<System> CloneSystem(System const& system) {
+            return CloneSystem<T>(system, is_copy_constructible<T>());
+        }
+
+        template <typename T>
+        static shared_ptr<System> CloneSystem(System const& system, true_type) {
+            return make_shared<T>(static_cast<T const&>(system));
+        }
+
+        template <typename T>
+        static shared_ptr<System> CloneSystem(System const& system, false_type) {
+            auto copy = make_shared<T>();
+            static_cast<System&>(*copy) = system;
+            return copy;
+        }
+
+        void BuildSchedule() {
+            if (!mScheduleDirty) return;
+
+            size_t count = mSystems.size();
+            mSuccessors.assign(count, vector<size_t>());
+            mDependencies.assign(count, 0);
+            mPending.reset(new atomic<uint32_t>[count]);
+            for (size_t j = 0; j < count; ++j) {
+                for (size_t i = 0; i < j; ++i) {
+                    if (Conflicts(*mSystems[i], *mSystems[j])) {
+                        mSuccessors[i].push_back(j);
+                        mDependencies[j]++;
+                    }
+                }
+            }
+            mScheduleDirty = false;
+        }
+
+        template <typename Func>
+        void ForEachInterested(Signature_T const &bits, Func&& fn) {
+            ++mStamp;
+            ForEachSetBit(bits, [&](size_t bit) {
+                for (auto index : mInterest[bit]) {
+                    if (mVisited[index] == mStamp) continue;
+                    mVisited[index] = mStamp;
+                    fn(mSystems[index]);
+                }
+            });
+        }
+};
+
+} // namespace Internal
+
+// ecs_view.h
+//----------------------------------------------------------------
+/*
+View<Ts...>:
+    iterate entities owning every T without going through systems.
+    The smallest ComponentArray drives the walk over its dense
+    entity/data pages, the other arrays are probed once per entity.
+
+    A const T is handed out as const T& and leaves T's change ticks
+    alone, a mutable T is marked changed for every entity visited.
+    An Optional<T> term is handed out as T*, nullptr when the entity
+    has no T. Exclude<Us...>() drops entities owning any of Us.
+    Given the EntityManager, With<Us...>()/Exclude<Us...>() test the
+    entity's signature with two mask operations instead, which is the
+    only way to filter on tags, they cannot be terms.
+    Changed<T>(since)/Added<T>(since) keep entities whose T was last
+    changed/added at a tick >= since. A filtered array drives the walk,
+    so its pages with nothing that new are skipped whole.
+
+    Do not add/remove Ts while iterating, the dense arrays swap-remove.
+*/
+template <typename T>
+struct Optional {};
+
+// how a View term is stored and handed to fn
+template <typename T>
+struct ViewTerm {
+    using Component = remove_const_t<T>;
+    using Ref = T&;
+    static const bool optional = false;
+    static const bool readOnly = is_const<T>::value;
+};
+
+template <typename T>
+struct ViewTerm<Optional<T>> {
+    using Component = remove_const_t<T>;
+    using Ref = T*;
+    static const bool optional = true;
+    static const bool readOnly = is_const<T>::value;
+};
+
+template <typename... Ts>
+class View {
+    public:
+        explicit View(ComponentManager& manager, EntityManager const* entities = nullptr)
+            : mManager(&manager), mEntities(entities), mArrays(manager.GetArray<typename ViewTerm<Ts>::Component>()...) {
+            static_assert(AnyRequired(), "View needs a term that is not Optional");
+            static_assert(!AnyTag(), "tags are filtered with With<>(), not terms");
+            mChangedSince.fill(0);
+            mAddedSince.fill(0);
+        }
+
+        // skip entities owning any of Us
+        template <typename... Us>
+        View& Exclude() {
+            int expand[] = { 0, (ExcludeOne<remove_const_t<Us>>(), 0)... };
+            (void)expand;
+            return *this;
+        }
+
+        // keep entities owning all of Us, needs the EntityManager
+        template <typename... Us>
+        View& With() {
+            o_assert_dbg(mEntities && "With<>() needs the entity signatures");
+            int expand[] = { 0, (mWith.set(ComponentTypeId<Us>(), true), 0)... };
+            (void)expand;
+            return *this;
+        }
+
+        template <typename T>
+        View& Changed(uint32_t since) {
+            static_assert(IndexOf<T>() < N, "T is not part of the View");
+            mChangedSince[IndexOf<T>()] = since;
+            return *this;
+        }
+
+        template <typename T>
+        View& Added(uint32_t since) {
+            static_assert(IndexOf<T>() < N, "T is not part of the View");
+            mAddedSince[IndexOf<T>()] = since;
+            return *this;
+        }
+
+        // fn(EntityId_T, Ts&... / T* for Optional<T>)
+        template <typename Func>
+        void Each(Func&& fn) {
+            EachImpl(fn, index_sequence_for<Ts...>());
+        }
+
+        /*
+            Each() with the driver's dense range split into chunks of
+            about grain entities, run on pool. Unless the driver is boxed,
+            chunk borders fall on cache line borders of its data, pages
+            being line aligned. fn runs concurrently and may only touch
+            the components it is handed.
+        */
+        template <typename Func>
+        void ParallelEach(ThreadPool* pool, size_t grain, Func&& fn) {
+            ParallelEachImpl(pool, grain, fn, index_sequence_for<Ts...>());
+        }
+
+        // upper bound of entities visited
+        EntityId_T SizeHint() const {
+            return Driver(index_sequence_for<Ts...>()).second;
+        }
+
+    private:
+        static const size_t N = sizeof...(Ts);
+
+        ComponentManager* mManager;
+        EntityManager const* mEntities;
+        tuple<ComponentArray<typename ViewTerm<Ts>::Component>*...> mArrays;
+        vector<IComponentArray const*> mExcluded;
+        // signature filters, used when mEntities is set
+        Signature_T mWith;
+        Signature_T mWithout;
+
+        template <typename U>
+        void ExcludeOne() {
+            if (mEntities) {
+                mWithout.set(ComponentTypeId<U>(), true);
+            } else {
+                o_assert_dbg(!IsTag<U>::value && "excluding a tag needs the entity signatures");
+                mExcluded.push_back(mManager->GetArray<U>());
+            }
+        }
+        // 0 when unfiltered, every tick is >= 0
+        array<uint32_t, N> mChangedSince;
+        array<uint32_t, N> mAddedSince;
+
+        // position of T in Ts, N if absent
+        template <typename T>
+        static constexpr size_t IndexOf() {
+            const bool same[] = { is_same<remove_const_t<T>, typename ViewTerm<Ts>::Component>::value... };
+            size_t i = 0;
+            while (i < N && !same[i]) ++i;
+            return i;
+        }
+
+        bool Filtered() const {
+            for (size_t i = 0; i < N; ++i) {
+                if (mChangedSince[i] || mAddedSince[i]) return true;
+            }
+            return false;
+        }
+
+        // (index, size) of the smallest required array, filtered ones first
+        template <size_t... Is>
+        pair<size_t, EntityId_T> Driver(index_sequence<Is...>) const {
+            array<EntityId_T, N> sizes = {{ get<Is>(mArrays)->Size()... }};
+            size_t best = 0;
+            auto rank = [&](size_t i) {
+                bool filtered = mChangedSince[i] || mAddedSince[i];
+                return make_tuple(OPTIONAL[i], !filtered, sizes[i]);
+            };
+            for (size_t i = 1; i < N; ++i) {
+                if (rank(i) < rank(best)) best = i;
+            }
+            return make_pair(best, sizes[best]);
+        }
+
+        template <typename Func, size_t... Is>
+        void EachImpl(Func& fn, index_sequence<Is...> seq) {
+            size_t driver = Driver(seq).first;
+            // expand once per T, run the walk driven by the chosen one
+            int expand[] = { (Is == driver ? (EachDriven<Is>(fn, 0, get<Is>(mArrays)->Size(), seq), 0) : 0)... };
+            (void)expand;
+        }
+
+        template <typename Func, size_t... Is>
+        void ParallelEachImpl(ThreadPool* pool, size_t grain, Func& fn, index_sequence<Is...> seq) {
+            size_t driver = Driver(seq).first;
+            int expand[] = { (Is == driver ? (ParallelDriven<Is>(pool, grain, fn, seq), 0) : 0)... };
+            (void)expand;
+        }
+
+        template <size_t D, typename Func, size_t... Is>
+        void ParallelDriven(ThreadPool* pool, size_t grain, Func& fn, index_sequence<Is...> seq) {
+            // smallest run of elements spanning whole lines, a page
+            // holds a whole number of these, so do chunks of a multiple
+            using DriverT = typename ViewTerm<typename tuple_element<D, tuple<Ts...>>::type>::Component;
+            size_t line = CACHE_LINE_SIZE;
+            while (line > 1 && (sizeof(DriverT) * (line / 2)) % CACHE_LINE_SIZE == 0) line /= 2;
+            grain = (max(grain, (size_t)1) + line - 1) / line * line;
+
+            ParallelFor(pool, get<D>(mArrays)->Size(), grain, [&](size_t begin, size_t end) {
+                EachDriven<D>(fn, (EntityId_T)begin, (EntityId_T)end, seq);
+            });
+        }
+
+        // walk dense ids [begin, end) of driver D page by page
+        template <size_t D, typename Func, size_t... Is>
+        void EachDriven(Func& fn, EntityId_T begin, EntityId_T end, index_sequence<Is...>) {
+            auto* driver = get<D>(mArrays);
+            bool filtered = Filtered();
+            for (EntityId_T base = begin; base < end;) {
+                EntityId_T first = base;
+                EntityId_T offset = base % ENTITY_PAGE_SIZE;
+                EntityId_T count = min(ENTITY_PAGE_SIZE - offset, end - base);
+                base += count;
+                // nothing on this page is new enough
+                if (driver->PageChangedTick(first) < mChangedSince[D] || driver->PageAddedTick(first) < mAddedSince[D]) {
+                    continue;
+                }
+                EntityId_T* entities = driver->EntityPage(first) + offset;
+                bool holes = driver->Stable();
+                // nullptr for boxed drivers, Ref() looks them up
+                auto* data = driver->DataPage(first);
+                if (data) data += offset;
+
+                for (EntityId_T i = 0; i < count; ++i) {
+                    if (holes && !driver->Occupied(first + i)) continue;
+                    EntityId_T entity = entities[i];
+                    // dense id per array, MAX_ENTITY if missing
+                    array<EntityId_T, N> ids = {{ (Is == D ? first + i : get<Is>(mArrays)->Find(entity))... }};
+                    bool complete = true;
+                    for (size_t t = 0; t < N; ++t) complete &= ids[t] != MAX_ENTITY || OPTIONAL[t];
+                    if (!complete || (filtered && !Passes(ids, index_sequence<Is...>()))) continue;
+                    if (Excluded(entity)) continue;
+
+                    int mark[] = { 0, (READ_ONLY[Is] || ids[Is] == MAX_ENTITY ? 0 : (get<Is>(mArrays)->MarkChanged(ids[Is]), 0))... };
+                    (void)mark;
+                    fn(entity, Ref<Is>(ids[Is], data ? data + i : nullptr, integral_constant<bool, Is == D>())...);
+                }
+            }
+        }
+
+        // a missing optional term only passes unfiltered
+        template <size_t... Is>
+        bool Passes(array<EntityId_T, N> const &ids, index_sequence<Is...>) const {
+            bool pass = true;
+            int expand[] = { 0, (pass &= ids[Is] == MAX_ENTITY
+                ? !mChangedSince[Is] && !mAddedSince[Is]
+                : get<Is>(mArrays)->ChangedTickAt(ids[Is]) >= mChangedSince[Is]
+                    && get<Is>(mArrays)->AddedTickAt(ids[Is]) >= mAddedSince[Is], 0)... };
+            (void)expand;
+            return pass;
+        }
+
+        bool Excluded(EntityId_T entity) const {
+            if (mWith.any() || mWithout.any()) {
+                Signature_T signature = mEntities->GetSignature(entity);
+                if ((signature & mWith) != mWith || (signature & mWithout).any()) return true;
+            }
+            for (auto* excluded : mExcluded) {
+                if (excluded->HasComponent(entity)) return true;
+            }
+            return false;
+        }
+
+        template <size_t I>
+        using RefOf = typename ViewTerm<typename tuple_element<I, tuple<Ts...>>::type>::Ref;
+
+        // driver: already in hand, never optional at runtime
+        template <size_t I, typename U>
+        RefOf<I> Ref(EntityId_T id, U* data, true_type) {
+            return Deref(data ? data : &get<I>(mArrays)->At(id), integral_constant<bool, OPTIONAL[I]>());
+        }
+
+        // others: dense lookup
+        template <size_t I, typename U>
+        RefOf<I> Ref(EntityId_T id, U*, false_type) {
+            return Deref(id == MAX_ENTITY ? nullptr : &get<I>(mArrays)->At(id), integral_constant<bool, OPTIONAL[I]>());
+        }
+
+        template <typename U>
+        static U& Deref(U* data, false_type) { return *data; }
+
+        template <typename U>
+        static U* Deref(U* data, true_type) { return data; }
+
+        static constexpr bool OPTIONAL[] = { ViewTerm<Ts>::optional... };
+        static constexpr bool READ_ONLY[] = { ViewTerm<Ts>::readOnly... };
+
+        static constexpr bool AnyTag() {
+            const bool tags[] = { IsTag<typename ViewTerm<Ts>::Component>::value... };
+            for (bool tag : tags) {
+                if (tag) return true;
+            }
+            return false;
+        }
+
+        static constexpr bool AnyRequired() {
+            for (bool optional : OPTIONAL) {
+                if (!optional) return true;
+            }
+            return false;
+        }
+};
+
+template <typename... Ts>
+constexpr bool View<Ts...>::OPTIONAL[];
+
+template <typename... Ts>
+constexpr bool View<Ts...>::READ_ONLY[];
+
+
+// ecs_command.h
+//----------------------------------------------------------------
+/*
+EntityCommandBuffer:
+    records structural changes (add/remove component, destroy entity)
+    while arrays and system entity sets are being iterated, applies
+    them later at a sync point, see World::Playback().
+
+    Commands are queued per component type. On playback every queue is
+    sorted by entity and coalesced, only the last command on an
+    entity/component pair is applied, one ComponentArray at a time.
+    Commands on one entity apply in SetSortKey() order, then in recorded
+    order.
+    Touched entities then get one membership update each with their net
+    signature change, and destroyed entities go through a single batched
+    DestroyEntities. Commands on stale handles, or on entities destroyed
+    by the same buffer, are dropped.
+
+    Recording is not thread safe, World keeps one buffer per recording
+    thread (GetCommandBuffer()) and merges them with Append() in thread
+    order. Keyed by the work item (e.g. the chunk begin), the merged
+    result does not depend on which thread ran what. Pending handles
+    from World::ReserveEntity() get their ids at playback, by key too.
+*/
+class EntityCommandBuffer {
+    class ICommandQueue {
+        public:
+            virtual ~ICommandQueue() = default;
+            virtual void CollectEntities(vector<EntityId_T>& out) const = 0;
+            // (sort key, handle) per command on a pending entity
+            virtual void CollectReserved(vector<pair<uint32_t, EntityId_T>>& out) const = 0;
+            // pending handles to the entities created for them
+            virtual void Resolve(Internal::EntityManager const& entities) = 0;
+            // doomed is sorted
+            virtual void Playback(Internal::EntityManager& entities, Internal::ComponentManager& components,
+                vector<EntityId_T> const &doomed) = 0;
+            virtual void Clear() = 0;
+            // move other's commands behind ours, other has the same T
+            virtual void Append(ICommandQueue& other) = 0;
+            virtual unique_ptr<ICommandQueue> MakeEmpty() const = 0;
+    };
+
+    template <typename T>
+    class CommandQueue : public ICommandQueue {
+        // value indexes mValues, REMOVE marks a removal
+        struct Command {
+            EntityId_T entity;
+            uint32_t sortKey;
+            uint32_t value;
+        };
+        static const uint32_t REMOVE = ~0u;
+
+        public:
+            template <typename... Args>
+            void Emplace(EntityId_T entity, uint32_t sortKey, Args&&... args) {
+                mCommands.push_back({entity, sortKey, (uint32_t)mValues.size()});
+                mValues.emplace_back(forward<Args>(args)...);
+            }
+
+            void Remove(EntityId_T entity, uint32_t sortKey) {
+                mCommands.push_back({entity, sortKey, REMOVE});
+            }
+
+            void Append(ICommandQueue& other) override {
+                auto &source = static_cast<CommandQueue&>(other);
+                uint32_t base = (uint32_t)mValues.size();
+                for (auto command : source.mCommands) {
+                    if (command.value != REMOVE) command.value += base;
+                    mCommands.push_back(command);
+                }
+                move(source.mValues.begin(), source.mValues.end(), back_inserter(mValues));
+                source.Clear();
+            }
+
+            unique_ptr<ICommandQueue> MakeEmpty() const override {
+                return make_unique<CommandQueue>();
+            }
+
+            void CollectEntities(vector<EntityId_T>& out) const override {
+                for (auto &command : mCommands) {
+                    out.push_back(command.entity);
+                }
+            }
+
+            void CollectReserved(vector<pair<uint32_t, EntityId_T>>& out) const override {
+                for (auto &command : mCommands) {
+                    if (Internal::EntityManager::IsReserved(command.entity)) {
+                        out.push_back({command.sortKey, command.entity});
+                    }
+                }
+            }
+
+            void Resolve(Internal::EntityManager const& entities) override {
+                for (auto &command : mCommands) {
+                    command.entity = entities.Resolve(command.entity);
+                }
+            }
+
+            void Playback(Internal::EntityManager& entities, Internal::ComponentManager& components,
+                vector<EntityId_T> const &doomed) override {
+                // tags only flip their bit
+                auto* array = IsTag<T>::value ? nullptr : components.GetArray<T>();
+                ComponentId_T id = ComponentTypeId<T>();
+                // stable, equal keys on one entity keep their recorded order
+                stable_sort(mCommands.begin(), mCommands.end(), [](Command const &a, Command const &b) {
+                    return a.entity != b.entity ? a.entity < b.entity : a.sortKey < b.sortKey;
+                });
+                for (size_t i = 0; i < mCommands.size(); ++i) {
+                    Command const &command = mCommands[i];
+                    EntityId_T entity = command.entity;
+                    // last command on an entity wins
+                    if (i + 1 < mCommands.size() && mCommands[i + 1].entity == entity) continue;
+                    if (!entities.IsAlive(entity) || binary_search(doomed.begin(), doomed.end(), entity)) continue;
+
+                    Signature_T signature = entities.GetSignature(entity);
+                    if (!array) {
+                        Signature_T before = signature;
+                        signature.set(id, command.value != REMOVE);
+                        components.OnTagsChanged(entity, before, signature);
+                    } else if (command.value == REMOVE) {
+                        if (!array->HasComponent(entity)) continue;
+                        array->RemoveComponent(entity);
+                        signature.set(id, false);
+                    } else if (T* data = array->TryGetComponent(entity)) {
+                        *data = move(mValues[command.value]);
+                    } else {
+                        array->EmplaceComponent(entity, move(mValues[command.value]));
+                        signature.set(id, true);
+                    }
+                    entities.SetSignature(entity, move(signature));
+                }
+            }
+
+            void Clear() override {
+                mCommands.clear();
+                mValues.clear();
+            }
+
+        private:
+            vector<Command> mCommands;
+            vector<T> mValues;
+    };
+
+    public:
+        EntityCommandBuffer() {
+            mSortKey = 0;
+        }
+        EntityCommandBuffer(EntityCommandBuffer const&) = delete;
+        void operator=(EntityCommandBuffer const&) = delete;
+
+        // key of the following commands, orders commands across buffers
+        void SetSortKey(uint32_t key) { mSortKey = key; }
+
+        // replaces T if the entity already has one at playback
+        template <typename T>
+        void AddComponent(EntityId_T entity, T component) {
+            Queue<T>().Emplace(entity, mSortKey, move(component));
+        }
+
+        template <typename T, typename... Args>
+        void EmplaceComponent(EntityId_T entity, Args&&... args) {
+            Queue<T>().Emplace(entity, mSortKey, forward<Args>(args)...);
+        }
+
+        template <typename T>
+        void RemoveComponent(EntityId_T entity) {
+            Queue<T>().Remove(entity, mSortKey);
+        }
+
+        void DestroyEntity(EntityId_T entity) {
+            mDestroyed.push_back(entity);
+        }
+
+        bool Empty() const {
+            return mTouched.none() && mDestroyed.empty();
+        }
+
+        // drop recorded commands, queues keep their capacity
+        void Clear() {
+            ForEachSetBit(mTouched, [&](size_t i) {
+                mQueues[i]->Clear();
+            });
+            mTouched.reset();
+            mDestroyed.clear();
+            mSortKey = 0;
+        }
+
+        // move other's commands behind ours, leaves other empty
+        void Append(EntityCommandBuffer& other) {
+            ForEachSetBit(other.mTouched, [&](size_t i) {
+                if (!mQueues[i]) {
+                    mQueues[i] = other.mQueues[i]->MakeEmpty();
+                }
+                mQueues[i]->Append(*other.mQueues[i]);
+            });
+            mTouched |= other.mTouched;
+            mDestroyed.insert(mDestroyed.end(), other.mDestroyed.begin(), other.mDestroyed.end());
+            other.Clear();
         }
 
     private:
-        unique_ptr<EntityManager> mEntityManager;
-        unique_ptr<ComponentManager> mComponentManager;
-        unique_ptr<SystemManager> mSystemManager;
+        friend class World;
+
+        array<unique_ptr<ICommandQueue>, MAX_COMPONENT> mQueues;
+        // component ids with recorded commands
+        Signature_T mTouched;
+        vector<EntityId_T> mDestroyed;
+        uint32_t mSortKey;
+
+        template <typename T>
+        CommandQueue<T>& Queue() {
+            ComponentId_T id = ComponentTypeId<T>();
+            if (!mQueues[id]) {
+                mQueues[id] = make_unique<CommandQueue<T>>();
+            }
+            mTouched.set(id, true);
+            return static_cast<CommandQueue<T>&>(*mQueues[id]);
+        }
+};
 
-        EcsEngine() {
+// ecs_world.h
+//----------------------------------------------------------------
+/*
+World:
+    one simulation, owns its entities, components, systems and command
+    buffers. Worlds share nothing but the type ids and an optional
+    thread pool, so several can run side by side, one per thread.
+    Systems reach theirs through System::mWorld. Not copyable or
+    movable, registered systems point at it.
+*/
+class World {
+    public:
+        World() {
             mEntityManager = make_unique<EntityManager>();
             mComponentManager = make_unique<ComponentManager>();
             mSystemManager = make_unique<SystemManager>();
+            mCommandBuffers.push_back(make_unique<EntityCommandBuffer>());
+            mSerial = NextSerial();
+        }
+
+        World(World const&) = delete;
+        void operator=(World const&) = delete;
+
+        //----------------------------------------------------------------
+        // Functions
+        //----------------------------------------------------------------
+        
+        EntityId_T CreateEntity() {
+            return mEntityManager->CreateEntity();
+        }
+
+        /*
+            lock free, for jobs that need an id right away. Returns a
+            pending handle to record commands on, typically through
+            GetCommandBuffer(). Playback creates the pending entities its
+            commands name in sort key order, then reservation order, so
+            with one key per work item the ids do not depend on which
+            thread reserved first. Adding components to it directly
+            creates it on the spot, queries see it as not alive before.
+            The handle resolves to its entity until FlushCommandBuffers(),
+            which ends every Update(), pending entities nothing named by
+            then are dropped. Handles stored inside components are not
+            resolved.
+        */
+        EntityId_T ReserveEntity() {
+            return mEntityManager->ReserveEntity();
+        }
+
+        // no-op for stale handles
+        void DestroyEntity(EntityId_T entity) {
+            entity = mEntityManager->Resolve(entity);
+            if (!mEntityManager->IsAlive(entity)) return;
+
+            Signature_T signature = mEntityManager->GetSignature(entity);
+            mComponentManager->RemoveAllComponents(entity, signature);
+            mSystemManager->OnEntityDestroy(entity, signature);
+            mEntityManager->DestroyEntity(entity);
+        }
+
+        // one compare, safe on handles kept across frames
+        bool IsAlive(EntityId_T entity) const {
+            return mEntityManager->IsAlive(mEntityManager->Resolve(entity));
+        }
+
+        // out must hold count ids
+        void CreateEntities(size_t count, EntityId_T* out) {
+            mEntityManager->CreateEntities(count, out);
+        }
+
+        void CreateEntities(size_t count, vector<EntityId_T>& out) {
+            size_t offset = out.size();
+            out.resize(offset + count);
+            CreateEntities(count, out.data() + offset);
+        }
+
+        // stale and repeated handles are skipped
+        void DestroyEntities(const EntityId_T* entities, size_t count) {
+            mEntityScratch.clear();
+            mSignatureScratch.clear();
+            Signature_T touched;
+            for (size_t i = 0; i < count; ++i) {
+                EntityId_T entity = mEntityManager->Resolve(entities[i]);
+                if (!mEntityManager->IsAlive(entity) || !mDoomedScratch.Insert(entity)) continue;
+                mEntityScratch.push_back(entity);
+                mSignatureScratch.push_back(mEntityManager->GetSignature(entity));
+                touched |= mSignatureScratch.back();
+            }
+            mDoomedScratch.Clear();
+            count = mEntityScratch.size();
+            mComponentManager->RemoveAllComponents(mEntityScratch.data(), mSignatureScratch.data(), count);
+            mSystemManager->OnEntitiesDestroy(mEntityScratch.data(), mSignatureScratch.data(), count, touched);
+            mEntityManager->DestroyEntities(mEntityScratch.data(), count);
+        }
+
+        void DestroyEntities(vector<EntityId_T> const &entities) {
+            DestroyEntities(entities.data(), entities.size());
+        }
+
+        // ----------------------------------------------------------------
+
+        // see Storage for the policies
+        template <typename T, typename Policy = Storage::Paged>
+        void ResisterComponent() { 
+            mComponentManager->RegisterComponent<T, Policy>();
+        }
+
+        template <typename T>
+        void AddComponent(EntityId_T entity, T component) {
+            AddComponents<T>(entity, move(component));
+        }
+
+        template <typename T>
+        void RemoveComponent(EntityId_T entity, T component) {
+            RemoveComponents<T>(entity);
+        }
+
+        /*
+            add/remove several components with a single signature
+            transition and a single membership update
+        */
+        // stale handles are a no-op, as for DestroyEntity
+        template <typename... Ts>
+        void AddComponents(EntityId_T entity, Ts... components) {
+            entity = Claim(entity);
+            if (!mEntityManager->IsAlive(entity)) return;
+
+            auto oldSignature = mEntityManager->GetSignature(entity);
+            auto signature = oldSignature;
+            int expand[] = { 0, (signature.set(mComponentManager->AddComponent<Ts>(entity, move(components)), true), 0)... };
+            (void)expand;
+            mComponentManager->OnTagsChanged(entity, oldSignature, signature);
+            mSystemManager->OnEntitySignatureUpdate(entity, oldSignature, signature);
+            mEntityManager->SetSignature(entity, move(signature));
+        }
+
+        template <typename... Ts>
+        void RemoveComponents(EntityId_T entity) {
+            entity = mEntityManager->Resolve(entity);
+            if (!mEntityManager->IsAlive(entity)) return;
+
+            auto oldSignature = mEntityManager->GetSignature(entity);
+            auto signature = oldSignature;
+            int expand[] = { 0, (signature.set(mComponentManager->RemoveComponent<Ts>(entity), false), 0)... };
+            (void)expand;
+            mComponentManager->OnTagsChanged(entity, oldSignature, signature);
+            mSystemManager->OnEntitySignatureUpdate(entity, oldSignature, signature);
+            mEntityManager->SetSignature(entity, move(signature));
+        }
+
+        // construct T(args...) in place, no temporary to copy or move
+        template <typename T, typename... Args>
+        void EmplaceComponent(EntityId_T entity, Args&&... args) {
+            entity = Claim(entity);
+            if (!mEntityManager->IsAlive(entity)) return;
+
+            auto oldSignature = mEntityManager->GetSignature(entity);
+            auto signature = oldSignature;
+            signature.set(mComponentManager->EmplaceComponent<T>(entity, forward<Args>(args)...), true);
+            mComponentManager->OnTagsChanged(entity, oldSignature, signature);
+            mSystemManager->OnEntitySignatureUpdate(entity, oldSignature, signature);
+            mEntityManager->SetSignature(entity, move(signature));
+        }
+
+        // fresh entity entering systems once with its final signature
+        template <typename... Ts>
+        EntityId_T CreateEntityWith(Ts... components) {
+            EntityId_T entity = mEntityManager->CreateEntity();
+            AddComponents<Ts...>(entity, move(components)...);
+            return entity;
+        }
+
+        // GetComponent<const T>() reads without marking T changed.
+        // A stale handle is a hard error, its slot may hold another entity
+        template <typename T>
+        T& GetComponent(EntityId_T entity) {
+            entity = mEntityManager->Resolve(entity);
+            if (!mEntityManager->IsAlive(entity)) {
+                o_error("World::GetComponent(): stale entity handle\n");
+            }
+            return GetComponent<T>(entity, is_const<T>());
+        }
+
+        template <typename T>
+        ComponentId_T GetComponentId() const { 
+            return mComponentManager->GetComponentId<T>();
+        }
+
+        // signature test, works for tags, false for stale handles
+        template <typename T>
+        bool HasComponent(EntityId_T entity) const {
+            entity = mEntityManager->Resolve(entity);
+            return mEntityManager->IsAlive(entity)
+                && mEntityManager->GetSignature(entity).test(ComponentTypeId<T>());
+        }
+
+        // With<>()/Exclude<>() take tags, tested on the entity signatures
+        template <typename... Ts>
+        View<Ts...> GetView() {
+            return View<Ts...>(*mComponentManager, mEntityManager.get());
+        }
+
+        // fn(EntityId_T, Ts&...) for every entity owning all Ts
+        template <typename... Ts, typename Func>
+        void Each(Func&& fn) {
+            GetView<Ts...>().Each(fn);
+        }
+
+        // Each() split into chunks of ~grain entities on the thread pool
+        template <typename... Ts, typename Func>
+        void ParallelEach(Func&& fn, size_t grain = DEFAULT_GRAIN) {
+            GetView<Ts...>().ParallelEach(mThreadPool.get(), grain, fn);
+        }
+
+        // ---------------------------------------------------------------------
+
+        template <typename T>
+        shared_ptr<T> ResisterSystem() {
+            auto system = mSystemManager->RegisterSystem<T>(this);
+            mComponentManager->Observe(mSystemManager->ObservedAdded(), mSystemManager->ObservedRemoved());
+            return system;
+        }
+
+        template <typename T>
+        shared_ptr<T> GetSystem() {
+            return mSystemManager->GetSystem<T>();
+        }
+
+        // run all systems, in parallel when a thread pool is set,
+        // apply the world's command buffers, then dispatch the
+        // frame's events to reactive systems
+        void Update() {
+            uint32_t tick = mComponentManager->Tick() + 1;
+            mComponentManager->SetTick(tick);
+            mSystemManager->Update(mThreadPool.get(), tick);
+            FlushCommandBuffers();
+            mSystemManager->DispatchEvents(*mComponentManager);
+        }
+
+        // advanced by Update(), stamped on component adds and writes
+        uint32_t GetTick() const { return mComponentManager->Tick(); }
+
+        /*
+            independent copy of entities, components, signatures and
+            systems with their memberships, sharing the thread pool.
+            Costs about the component bytes, trivially copyable types
+            are copied page-wise with memcpy. Pending command buffers
+            stay behind, clone between frames.
+        */
+        unique_ptr<World> Clone() const {
+            auto world = make_unique<World>();
+            world->mEntityManager = make_unique<EntityManager>(*mEntityManager);
+            world->mComponentManager = mComponentManager->Clone();
+            world->mSystemManager = mSystemManager->Clone(world.get());
+            world->SetThreadPool(mThreadPool);
+            return world;
+        }
+
+        /*
+            close the holes Storage::Stable arrays leave on removal.
+            Components move, pointers into them are invalid afterwards,
+            so call it between frames where no bridge holds any.
+        */
+        void Compact() { mComponentManager->Compact(); }
+
+        /*
+            the calling thread's buffer, one per worker of the pool and
+            one per other thread that asked. Applied at the end of
+            Update() or by FlushCommandBuffers().
+        */
+        EntityCommandBuffer& GetCommandBuffer() {
+            size_t worker = mThreadPool ? mThreadPool->WorkerIndex() : 0;
+            if (worker) return *mCommandBuffers[worker];
+
+            // last world this thread recorded into, serials are never reused
+            struct Cached {
+                uint64_t world;
+                EntityCommandBuffer* buffer;
+            };
+            static thread_local Cached cached = {0, nullptr};
+            if (cached.world != mSerial) {
+                cached = {mSerial, &ThreadBuffer()};
+            }
+            return *cached.buffer;
+        }
+
+        /*
+            merge the per-thread buffers, other threads in first use
+            order then the pool workers, and play back once. Pending
+            handles from ReserveEntity() are forgotten afterwards.
+        */
+        void FlushCommandBuffers() {
+            auto &merged = *mCommandBuffers[0];
+            {
+                lock_guard<mutex> lock(mThreadBuffersMutex);
+                for (auto &buffer : mThreadBuffers) {
+                    merged.Append(*buffer.second);
+                }
+            }
+            for (size_t i = 1; i < mCommandBuffers.size(); ++i) {
+                merged.Append(*mCommandBuffers[i]);
+            }
+            Playback(merged);
+            mEntityManager->ClearReserved();
+        }
+
+        // apply and clear buffer, not while arrays or systems are iterated
+        void Playback(EntityCommandBuffer& buffer) {
+            if (buffer.Empty()) return;
+
+            // pending entities the commands name come first, in (sort key,
+            // reservation) order, a handle under several keys by its lowest
+            mReservedScratch.clear();
+            ForEachSetBit(buffer.mTouched, [&](size_t i) {
+                buffer.mQueues[i]->CollectReserved(mReservedScratch);
+            });
+            if (!mReservedScratch.empty()) {
+                sort(mReservedScratch.begin(), mReservedScratch.end());
+                for (auto const &reserved : mReservedScratch) {
+                    mEntityManager->CreateReserved(reserved.second);
+                }
+                ForEachSetBit(buffer.mTouched, [&](size_t i) {
+                    buffer.mQueues[i]->Resolve(*mEntityManager);
+                });
+            }
+
+            // deduped and alive, sorted for lookups from the queues
+            auto &doomed = buffer.mDestroyed;
+            for (auto &entity : doomed) {
+                entity = mEntityManager->Resolve(entity);
+            }
+            sort(doomed.begin(), doomed.end());
+            doomed.erase(unique(doomed.begin(), doomed.end()), doomed.end());
+            doomed.erase(remove_if(doomed.begin(), doomed.end(), [&](EntityId_T entity) {
+                return !mEntityManager->IsAlive(entity);
+            }), doomed.end());
+
+            // every entity that may change signature, with its signature before
+            mTouchedScratch.clear();
+            ForEachSetBit(buffer.mTouched, [&](size_t i) {
+                buffer.mQueues[i]->CollectEntities(mTouchedScratch);
+            });
+            sort(mTouchedScratch.begin(), mTouchedScratch.end());
+            mTouchedScratch.erase(unique(mTouchedScratch.begin(), mTouchedScratch.end()), mTouchedScratch.end());
+            mTouchedScratch.erase(remove_if(mTouchedScratch.begin(), mTouchedScratch.end(), [&](EntityId_T entity) {
+                return !mEntityManager->IsAlive(entity) || binary_search(doomed.begin(), doomed.end(), entity);
+            }), mTouchedScratch.end());
+            mOldSignatures.resize(mTouchedScratch.size());
+            for (size_t i = 0; i < mTouchedScratch.size(); ++i) {
+                mOldSignatures[i] = mEntityManager->GetSignature(mTouchedScratch[i]);
+            }
+
+            // one component array at a time
+            ForEachSetBit(buffer.mTouched, [&](size_t i) {
+                buffer.mQueues[i]->Playback(*mEntityManager, *mComponentManager, doomed);
+            });
+
+            // one membership update per entity, net of all its commands
+            for (size_t i = 0; i < mTouchedScratch.size(); ++i) {
+                Signature_T signature = mEntityManager->GetSignature(mTouchedScratch[i]);
+                if (signature != mOldSignatures[i]) {
+                    mSystemManager->OnEntitySignatureUpdate(mTouchedScratch[i], mOldSignatures[i], signature);
+                }
+            }
+
+            if (!doomed.empty()) {
+                DestroyEntities(doomed);
+            }
+            buffer.Clear();
+        }
+
+        // may be shared between worlds, nullptr runs serially
+        void SetThreadPool(shared_ptr<ThreadPool> pool) {
+            FlushCommandBuffers();
+            mThreadPool = move(pool);
+            size_t threads = mThreadPool ? mThreadPool->WorkerCount() + 1 : 1;
+            mCommandBuffers.resize(threads);
+            for (auto &buffer : mCommandBuffers) {
+                if (!buffer) buffer = make_unique<EntityCommandBuffer>();
+            }
+        }
+
+        ThreadPool* GetThreadPool() const { return mThreadPool.get(); }
+
+    private:
+        template <typename T>
+        T& GetComponent(EntityId_T entity, true_type) {
+            return mComponentManager->ReadComponent<remove_const_t<T>>(entity);
+        }
+
+        template <typename T>
+        T& GetComponent(EntityId_T entity, false_type) {
+            return mComponentManager->GetComponent<T>(entity);
+        }
+
+        // pending handles get their entity, created here if need be
+        EntityId_T Claim(EntityId_T entity) {
+            return EntityManager::IsReserved(entity) ? mEntityManager->CreateReserved(entity) : entity;
+        }
+
+        // buffer of the calling thread, which is not a pool worker
+        EntityCommandBuffer& ThreadBuffer() {
+            lock_guard<mutex> lock(mThreadBuffersMutex);
+            thread::id self = this_thread::get_id();
+            for (auto &buffer : mThreadBuffers) {
+                if (buffer.first == self) return *buffer.second;
+            }
+            mThreadBuffers.emplace_back(self, make_unique<EntityCommandBuffer>());
+            return *mThreadBuffers.back().second;
+        }
+
+        // drop every recorded command
+        void ClearCommandBuffers() {
+            for (auto &buffer : mCommandBuffers) {
+                buffer->Clear();
+            }
+            lock_guard<mutex> lock(mThreadBuffersMutex);
+            for (auto &buffer : mThreadBuffers) {
+                buffer.second->Clear();
+            }
+        }
+
+        static uint64_t NextSerial() {
+            static atomic<uint64_t> serial(1);
+            return serial++;
+        }
+
+        unique_ptr<EntityManager> mEntityManager;
+        unique_ptr<ComponentManager> mComponentManager;
+        unique_ptr<SystemManager> mSystemManager;
+        shared_ptr<ThreadPool> mThreadPool;
+        // [0] collects the merge, [i] is pool worker i, see GetCommandBuffer()
+        vector<unique_ptr<EntityCommandBuffer>> mCommandBuffers;
+        // threads outside the pool, in first use order
+        vector<pair<thread::id, unique_ptr<EntityCommandBuffer>>> mThreadBuffers;
+        mutex mThreadBuffersMutex;
+        // tells worlds apart in the threads' buffer caches
+        uint64_t mSerial;
+        // scratch for DestroyEntities and Playback
+        vector<EntityId_T> mEntityScratch;
+        vector<Signature_T> mSignatureScratch;
+        EntitySet mDoomedScratch;
+        vector<EntityId_T> mTouchedScratch;
+        vector<Signature_T> mOldSignatures;
+        vector<pair<uint32_t, EntityId_T>> mReservedScratch;
+
+    friend class History;
+};
+
+// former name, from when there was one instance per process
+using EcsEngine = World;
+
+// ecs_history.h
+//----------------------------------------------------------------
+/*
+History:
+    rollback buffer of a World, one Save() per tick, any of the last
+    capacity saved ticks can be restored.
+
+    Every keyframeInterval-th save copies the entity manager and all
+    component arrays. The saves in between keep deltas: the entity
+    slots written since the previous save, and per array the slots
+    whose change tick is at or after the previous save's tick. An array
+    that added or removed components since then no longer lines up by
+    dense id and is copied whole for that save instead.
+
+    Each save also keeps every system's last run tick, and the system
+    memberships in iteration order when they may have changed since
+    the previous save. Restore(tick) rebuilds from the keyframe before
+    tick, puts memberships and ticks back, so resimulating iterates and
+    filters Changed<T> as the original run did, and drops pending
+    command buffers. State of System subclasses is not saved.
+
+    Deltas come from change tracking, writes that bypass mutable
+    access (e.g. through held pointers) are not seen.
+    The World must outlive its History.
+*/
+class History {
+    struct ArrayState {
+        // registered when saved
+        bool saved = false;
+        uint32_t version = 0;
+        // whole copy, or the slots changed since the previous save
+        unique_ptr<IComponentArray> full;
+        unique_ptr<IComponentPatch> patch;
+    };
+
+    struct Entry {
+        uint32_t tick;
+        // keyframes hold entities, deltas entityPatch
+        unique_ptr<EntityManager> entities;
+        EntityManager::Patch entityPatch;
+        vector<ArrayState> arrays;
+        // per system, memberships only if they may have changed
+        vector<uint32_t> lastRunTicks;
+        bool membersSaved = false;
+        uint32_t membershipVersion = 0;
+        vector<vector<EntityId_T>> members;
+    };
+
+    public:
+        explicit History(World& world, size_t capacity = 8, size_t keyframeInterval = 4)
+            : mWorld(&world), mCapacity(max(capacity, (size_t)1)), mInterval(max(keyframeInterval, (size_t)1)) {
+            mWorld->mEntityManager->Track(true);
+        }
+
+        ~History() {
+            mWorld->mEntityManager->Track(false);
+        }
+
+        History(History const&) = delete;
+        void operator=(History const&) = delete;
+
+        /*
+            save the world as of its current tick, between frames.
+            Saving a tick again drops it and everything after, as when
+            resimulating after a Restore().
+        */
+        void Save() {
+            uint32_t tick = mWorld->GetTick();
+            bool keyframe = mEntries.empty() || mSinceKeyframe + 1 >= mInterval;
+            while (!mEntries.empty() && mEntries.back().tick >= tick) {
+                mEntries.pop_back();
+                // the tracked writes were relative to the dropped save
+                keyframe = true;
+            }
+            keyframe |= mEntries.empty();
+
+            Entry entry;
+            entry.tick = tick;
+            entry.arrays.resize(MAX_COMPONENT);
+            auto &entities = *mWorld->mEntityManager;
+            if (keyframe) {
+                entry.entities = make_unique<EntityManager>(entities);
+                entities.Track(true);
+            } else {
+                entry.entityPatch = entities.TakePatch();
+            }
+
+            Entry const* last = mEntries.empty() ? nullptr : &mEntries.back();
+            auto &systems = *mWorld->mSystemManager;
+            entry.lastRunTicks = systems.SaveLastRunTicks();
+            entry.membershipVersion = systems.MembershipVersion();
+            if (keyframe || last->membershipVersion != entry.membershipVersion) {
+                entry.members = systems.SaveMemberships();
+                entry.membersSaved = true;
+            }
+
+            auto &components = *mWorld->mComponentManager;
+            for (size_t id = 0; id < MAX_COMPONENT; ++id) {
+                IComponentArray* array = components.GetArray((ComponentId_T)id);
+                if (!array) continue;
+
+                ArrayState &state = entry.arrays[id];
+                state.saved = true;
+                state.version = array->Version();
+                if (keyframe || !last->arrays[id].saved || last->arrays[id].version != state.version) {
+                    state.full = array->Clone();
+                } else {
+                    state.patch = array->SaveChanged(last->tick);
+                }
+            }
+
+            mSinceKeyframe = keyframe ? 0 : mSinceKeyframe + 1;
+            mEntries.push_back(move(entry));
+            Evict();
+        }
+
+        // false if tick was not saved or already evicted
+        bool Restore(uint32_t tick) {
+            size_t target = Find(tick);
+            if (target == mEntries.size()) return false;
+
+            size_t key = target;
+            while (!mEntries[key].entities) --key;
+            auto entities = make_unique<EntityManager>(*mEntries[key].entities);
+            for (size_t i = key + 1; i <= target; ++i) {
+                entities->ApplyPatch(mEntries[i].entityPatch);
+            }
+            entities->Track(true);
+            entities->ClearReserved();
+
+            auto &components = *mWorld->mComponentManager;
+            components.SetTick(tick);
+            for (size_t id = 0; id < MAX_COMPONENT; ++id) {
+                if (!mEntries[target].arrays[id].saved) continue;
+
+                // newest whole copy at or before target, then its patches
+                size_t base = target;
+                while (!mEntries[base].arrays[id].full) --base;
+                auto array = mEntries[base].arrays[id].full->Clone();
+                for (size_t i = base + 1; i <= target; ++i) {
+                    array->ApplyPatch(*mEntries[i].arrays[id].patch);
+                }
+                components.RestoreArray((ComponentId_T)id, move(array));
+            }
+
+            mWorld->mEntityManager = move(entities);
+            size_t members = target;
+            while (!mEntries[members].membersSaved) --members;
+            mWorld->mSystemManager->Restore(mEntries[members].members, mEntries[target].lastRunTicks,
+                *mWorld->mEntityManager);
+            mWorld->ClearCommandBuffers();
+            // saves after target stay restorable until tick is saved again
+            mSinceKeyframe = target - key;
+            return true;
+        }
+
+        bool Has(uint32_t tick) const { return Find(tick) != mEntries.size(); }
+        size_t Size() const { return mEntries.size(); }
+
+        void Clear() {
+            mEntries.clear();
+            mSinceKeyframe = 0;
+        }
+
+    private:
+        World* mWorld;
+        size_t mCapacity;
+        size_t mInterval;
+        // saves since the last keyframe
+        size_t mSinceKeyframe = 0;
+        deque<Entry> mEntries;
+
+        size_t Find(uint32_t tick) const {
+            for (size_t i = 0; i < mEntries.size(); ++i) {
+                if (mEntries[i].tick == tick) return i;
+            }
+            return mEntries.size();
+        }
+
+        // drop the oldest keyframe and its deltas once the rest covers capacity
+        void Evict() {
+            for (;;) {
+                size_t next = 1;
+                while (next < mEntries.size() && !mEntries[next].entities) ++next;
+                if (next == mEntries.size() || mEntries.size() - next < mCapacity) return;
+                mEntries.erase(mEntries.begin(), mEntries.begin() + next);
+            }
         }
 };
 
@@ -36,6 +36,113 @@ bool CompareArray(std::array<T, N> a, std::array<T, N> b) {
     return match;
 }
 
+// ----------------------------------------------------------------
+// PagedArray
+// ----------------------------------------------------------------
+
+TEST_CASE( "verify PagedArray", "[ecs]" ) {
+    const Ecs::EntityId_T page = Ecs::ENTITY_PAGE_SIZE;
+    Ecs::Internal::PagedArray<Ecs::EntityId_T> pa(Ecs::MAX_ENTITY);
+
+    REQUIRE( pa.PageCount() == 0 );
+    REQUIRE( pa.Get(5) == Ecs::MAX_ENTITY );
+    REQUIRE( !pa.HasPage(5) );
+
+    // only touched pages are allocated
+    pa.Assure(5) = 5;
+    pa.Assure(3 * page + 1) = 42;
+    REQUIRE( pa.PageCount() == 2 );
+    REQUIRE( pa[5] == 5 );
+    REQUIRE( pa[3 * page + 1] == 42 );
+    REQUIRE( pa.Get(3 * page) == Ecs::MAX_ENTITY );
+    REQUIRE( pa.Get(2 * page) == Ecs::MAX_ENTITY );
+    REQUIRE( !pa.HasPage(2 * page) );
+}
+
+// ----------------------------------------------------------------
+// TypeIndex
+// ----------------------------------------------------------------
+
+TEST_CASE( "verify TypeIndex", "[ecs]" ) {
+    struct X {};
+    struct Y {};
+    using Components = Ecs::TypeIndex<Ecs::ComponentFamily>;
+    using Systems = Ecs::TypeIndex<Ecs::SystemFamily>;
+
+    // stable and distinct per type
+    REQUIRE( Components::Get<X>() == Components::Get<X>() );
+    REQUIRE( Components::Get<X>() != Components::Get<Y>() );
+    REQUIRE( Ecs::ComponentTypeId<const X>() == Ecs::ComponentTypeId<X>() );
+
+    // families count on their own
+    auto sx = Systems::Get<X>();
+    auto sy = Systems::Get<Y>();
+    REQUIRE( sy == sx + 1 );
+}
+
+// ----------------------------------------------------------------
+// EntitySet
+// ----------------------------------------------------------------
+
+TEST_CASE( "verify EntitySet", "[ecs]" ) {
+    Ecs::Internal::EntitySet set;
+    REQUIRE( set.Empty() );
+
+    REQUIRE( set.Insert(3) );
+    REQUIRE( set.Insert(5000) );
+    REQUIRE( set.Insert(7) );
+    REQUIRE( !set.Insert(7) );
+    REQUIRE( set.Size() == 3 );
+    REQUIRE( set.Contains(5000) );
+    REQUIRE( !set.Contains(4) );
+
+    // swap-remove keeps the rest reachable
+    REQUIRE( set.Erase(3) );
+    REQUIRE( !set.Erase(3) );
+    REQUIRE( set.Size() == 2 );
+    REQUIRE( set.Contains(7) );
+    REQUIRE( set.Contains(5000) );
+
+    Ecs::EntityId_T sum = 0;
+    for (auto entity : set) sum += entity;
+    REQUIRE( sum == 5007 );
+
+    set.Clear();
+    REQUIRE( set.Empty() );
+    REQUIRE( !set.Contains(7) );
+    REQUIRE( set.Insert(7) );
+}
+
+TEST_CASE( "verify EntityHashMap", "[ecs]" ) {
+    Ecs::Internal::EntityHashMap map;
+    REQUIRE( map.Get(7) == Ecs::MAX_ENTITY );
+    map.Erase(7);
+
+    // mirror random inserts/erases in a flat array
+    const Ecs::EntityId_T keys = 4096;
+    std::vector<Ecs::EntityId_T> mirror(keys, Ecs::MAX_ENTITY);
+    size_t count = 0;
+    uint32_t seed = 12345;
+    for (int step = 0; step < 100000; ++step) {
+        seed = seed * 1664525u + 1013904223u;
+        Ecs::EntityId_T key = (seed >> 8) % keys;
+        if ((seed >> 4) % 3) {
+            if (mirror[key] == Ecs::MAX_ENTITY) count++;
+            mirror[key] = step;
+            map.Set(key, step);
+        } else {
+            if (mirror[key] != Ecs::MAX_ENTITY) count--;
+            mirror[key] = Ecs::MAX_ENTITY;
+            map.Erase(key);
+        }
+    }
+    REQUIRE( map.Size() == count );
+    bool same = true;
+    for (Ecs::EntityId_T key = 0; key < keys; ++key) same &= map.Get(key) == mirror[key];
+    REQUIRE( same );
+    REQUIRE( map.Capacity() * 3 >= map.Size() * 4 );
+}
+
 // ----------------------------------------------------------------
 // EntityManager
 // ----------------------------------------------------------------
@@ -62,6 +169,61 @@ TEST_CASE( "verify EntityManager", "[ecs]" ) {
         REQUIRE( entityManager.Size() == 1 );
     }
 
+    SECTION( "Freed ids are reused LIFO" ) {
+        auto ett0 = entityManager.CreateEntity();
+        auto ett1 = entityManager.CreateEntity();
+        auto ett2 = entityManager.CreateEntity();
+        entityManager.DestroyEntity(ett0);
+        entityManager.DestroyEntity(ett2);
+        REQUIRE( entityManager.IsAlive(ett1) );
+        REQUIRE( !entityManager.IsAlive(ett2) );
+        REQUIRE( Ecs::EntityIndex(entityManager.CreateEntity()) == ett2 );
+        REQUIRE( Ecs::EntityIndex(entityManager.CreateEntity()) == ett0 );
+        REQUIRE( entityManager.CreateEntity() == 3 );
+    }
+
+    SECTION( "Stale handles are detected" ) {
+        auto ett0 = entityManager.CreateEntity();
+        entityManager.DestroyEntity(ett0);
+        auto reused = entityManager.CreateEntity();
+
+        // same slot, next generation
+        REQUIRE( Ecs::EntityIndex(reused) == Ecs::EntityIndex(ett0) );
+        REQUIRE( Ecs::EntityGeneration(reused) == Ecs::EntityGeneration(ett0) + 1 );
+        REQUIRE( entityManager.IsAlive(reused) );
+        REQUIRE( !entityManager.IsAlive(ett0) );
+        REQUIRE( !entityManager.IsAlive(Ecs::NULL_ENTITY) );
+        // never-used slots match no handle
+        REQUIRE( !entityManager.IsAlive(Ecs::ENTITY_INDEX_MASK) );
+        REQUIRE( !entityManager.IsAlive(~Ecs::ENTITY_INDEX_MASK) );
+        REQUIRE( !entityManager.IsAlive(Ecs::MakeEntity(5000, 0)) );
+
+        // a hot slot runs through every generation, then retires
+        // instead of wrapping back to a handle someone may still hold
+        vector<Ecs::EntityId_T> lives(1, ett0);
+        auto handle = reused;
+        while (Ecs::EntityGeneration(handle) + 1 < Ecs::NULL_GENERATION) {
+            lives.push_back(handle);
+            entityManager.DestroyEntity(handle);
+            handle = entityManager.CreateEntity();
+            REQUIRE( Ecs::EntityIndex(handle) == Ecs::EntityIndex(ett0) );
+        }
+        lives.push_back(handle);
+        REQUIRE( lives.size() == Ecs::NULL_GENERATION );
+        entityManager.DestroyEntity(handle);
+        auto next = entityManager.CreateEntity();
+        REQUIRE( Ecs::EntityIndex(next) != Ecs::EntityIndex(ett0) );
+        for (int i = 0; i < 3; ++i) {
+            entityManager.DestroyEntity(next);
+            next = entityManager.CreateEntity();
+            REQUIRE( Ecs::EntityIndex(next) != Ecs::EntityIndex(ett0) );
+        }
+        bool anyAlive = false;
+        for (auto life : lives) anyAlive |= entityManager.IsAlive(life);
+        REQUIRE( !anyAlive );
+        REQUIRE( entityManager.Size() == 1 );
+    }
+
     SECTION( "verify Get and Set Signature" ) {
         auto ett0 = entityManager.CreateEntity();
         auto ett1 = entityManager.CreateEntity();
@@ -89,6 +251,46 @@ TEST_CASE( "verify EntityManager", "[ecs]" ) {
         sig0 = entityManager.GetSignature(ett0);
         REQUIRE( sig0.none() );
     }
+
+    SECTION( "Bulk Create and Destroy" ) {
+        vector<Ecs::EntityId_T> ids(3 * Ecs::ENTITY_PAGE_SIZE);
+        entityManager.CreateEntities(ids.size(), ids.data());
+        REQUIRE( entityManager.Size() == ids.size() );
+        REQUIRE( ids.back() == ids.size() - 1 );
+
+        // freed ids are handed out again before fresh ones, last freed first
+        entityManager.DestroyEntities(ids.data(), 10);
+        REQUIRE( entityManager.Size() == ids.size() - 10 );
+        REQUIRE( !entityManager.IsAlive(0) );
+        entityManager.CreateEntities(20, ids.data());
+        REQUIRE( entityManager.Size() == ids.size() + 10 );
+        REQUIRE( Ecs::EntityIndex(ids[0]) == 9 );
+        REQUIRE( Ecs::EntityIndex(ids[9]) == 0 );
+        REQUIRE( ids[10] == 3 * Ecs::ENTITY_PAGE_SIZE );
+        REQUIRE( entityManager.GetSignature(ids[19]).none() );
+
+        // a repeat is stale once its first copy is gone, it frees nothing
+        Ecs::EntityId_T twice[] = { ids[0], ids[1], ids[0] };
+        entityManager.DestroyEntities(twice, 3);
+        REQUIRE( entityManager.Size() == ids.size() + 8 );
+        REQUIRE( Ecs::EntityIndex(entityManager.CreateEntity()) == Ecs::EntityIndex(ids[1]) );
+        REQUIRE( Ecs::EntityIndex(entityManager.CreateEntity()) == Ecs::EntityIndex(ids[0]) );
+        REQUIRE( entityManager.CreateEntity() == 3 * Ecs::ENTITY_PAGE_SIZE + 10 );
+    }
+
+    SECTION( "Scale past a single page" ) {
+        const int count = 250000;
+        for (int i = 0; i < count; ++i) {
+            entityManager.CreateEntity();
+        }
+        REQUIRE( entityManager.Size() == count );
+
+        Ecs::Signature_T sig;
+        sig.set(3, true);
+        entityManager.SetSignature(count - 1, sig);
+        REQUIRE( entityManager.GetSignature(count - 1)[3] );
+        REQUIRE( entityManager.GetSignature(count - 2).none() );
+    }
 }
 
 // ----------------------------------------------------------------
@@ -139,6 +341,16 @@ TEST_CASE( "verify ComponentArray" , "[ecs]") {
         REQUIRE(ca.Size() == 0);
     }
 
+    SECTION("Stale handle does not alias") {
+        Ecs::EntityId_T stale = Ecs::MakeEntity(5, 0);
+        Ecs::EntityId_T fresh = Ecs::MakeEntity(5, 1);
+        ca.AddComponent(fresh, {5, "fresh", {0,0,0}});
+        REQUIRE( ca.HasComponent(fresh) );
+        REQUIRE( !ca.HasComponent(stale) );
+        REQUIRE( ca.TryGetComponent(stale) == nullptr );
+        REQUIRE( ca.TryGetComponent(fresh)->a == 5 );
+    }
+
     SECTION("Repeat Add/Remove") {
         ca.AddComponent(1, {0, "first", {0,1,2}});
         ca.AddComponent(10, {1, "second", {3,4,5}});
@@ -167,6 +379,117 @@ TEST_CASE( "verify ComponentArray" , "[ecs]") {
 
 }
 
+TEST_CASE( "verify ComponentArray lifetime" , "[ecs]") {
+    // counts live instances, has no default constructor
+    struct Counted {
+        static int& Live() { static int live = 0; return live; }
+        int v;
+        explicit Counted(int v) : v(v) { Live()++; }
+        Counted(Counted const& o) : v(o.v) { Live()++; }
+        Counted& operator=(Counted const&) = default;
+        ~Counted() { Live()--; }
+    };
+
+    {
+        Ecs::Internal::ComponentArray<Counted> ca;
+        // registering constructs nothing
+        REQUIRE( Counted::Live() == 0 );
+
+        ca.AddComponent(1, Counted(1));
+        ca.AddComponent(2, Counted(2));
+        ca.AddComponent(3, Counted(3));
+        REQUIRE( Counted::Live() == 3 );
+
+        ca.RemoveComponent(1);
+        REQUIRE( Counted::Live() == 2 );
+        REQUIRE( ca.GetComponent(3).v == 3 );
+        ca.RemoveComponent(3);
+        REQUIRE( Counted::Live() == 1 );
+    }
+    // the rest is destroyed with the array
+    REQUIRE( Counted::Live() == 0 );
+
+    // pages honour over-aligned types
+    struct alignas(64) Wide { float f[16]; };
+    Ecs::Internal::ComponentArray<Wide> wide;
+    for (Ecs::EntityId_T i = 0; i < 3; ++i) {
+        wide.AddComponent(i, Wide());
+        REQUIRE( reinterpret_cast<uintptr_t>(&wide.GetComponent(i)) % 64 == 0 );
+    }
+}
+
+TEST_CASE( "verify ComponentArray moves" , "[ecs]") {
+    // counts copies, moves are free
+    struct Heavy {
+        static int& Copies() { static int copies = 0; return copies; }
+        vector<int> data;
+        Heavy(int n, int v) : data(n, v) {}
+        Heavy(Heavy&&) = default;
+        Heavy& operator=(Heavy&&) = default;
+        Heavy(Heavy const& o) : data(o.data) { Copies()++; }
+        Heavy& operator=(Heavy const& o) { data = o.data; Copies()++; return *this; }
+    };
+
+    Ecs::Internal::ComponentArray<Heavy> ca;
+    ca.AddComponent(1, Heavy(4, 1));
+    ca.EmplaceComponent(2, 8, 2);
+    ca.EmplaceComponent(3, 16, 3);
+    ca.RemoveComponent(1);
+    ca.RemoveComponents(std::vector<Ecs::EntityId_T>({2}).data(), 1);
+    REQUIRE( Heavy::Copies() == 0 );
+    REQUIRE( ca.GetComponent(3).data.size() == 16 );
+
+    // move-only, trivially relocatable
+    Ecs::Internal::ComponentArray<unique_ptr<int>> up;
+    up.AddComponent(1, make_unique<int>(1));
+    up.EmplaceComponent(2, new int(2));
+    up.RemoveComponent(1);
+    REQUIRE( *up.GetComponent(2) == 2 );
+    static_assert(Ecs::IsTriviallyRelocatable<unique_ptr<int>>::value, "");
+    static_assert(!Ecs::IsTriviallyRelocatable<Heavy>::value, "");
+    // a deleter with state of its own is only as relocatable as that state
+    struct Deleter { string name; void operator()(int* p) const { delete p; } };
+    static_assert(!Ecs::IsTriviallyRelocatable<unique_ptr<int, Deleter>>::value, "");
+}
+
+template <typename T, typename Make>
+void VerifyBatchedRemoval(Ecs::Internal::ComponentArray<T>& ca, Make&& make) {
+    using Ecs::EntityId_T;
+    const EntityId_T count = 3 * Ecs::ENTITY_PAGE_SIZE + 17;
+    for (EntityId_T i = 0; i < count; ++i) ca.AddComponent(i, make(i));
+
+    // runs of gaps, scattered gaps and part of the tail, across pages
+    vector<EntityId_T> removed;
+    for (EntityId_T i = 0; i < count; ++i) {
+        if ((i >= 100 && i < 1300) || i % 7 == 3 || i + 40 >= count) removed.push_back(i);
+    }
+    ca.RemoveComponents(removed.data(), removed.size());
+    REQUIRE( ca.Size() == count - removed.size() );
+
+    bool intact = true;
+    for (EntityId_T i = 0; i < count; ++i) {
+        bool gone = binary_search(removed.begin(), removed.end(), i);
+        intact &= ca.HasComponent(i) != gone;
+        if (!gone) intact &= ca.GetComponent(i) == make(i);
+    }
+    REQUIRE( intact );
+}
+
+TEST_CASE( "verify ComponentArray batched removal" , "[ecs]") {
+    SECTION("trivially relocatable") {
+        Ecs::Internal::ComponentArray<uint64_t> ca;
+        VerifyBatchedRemoval(ca, [](Ecs::EntityId_T i) { return (uint64_t)i * 3; });
+    }
+    SECTION("move constructed") {
+        Ecs::Internal::ComponentArray<string> ca;
+        VerifyBatchedRemoval(ca, [](Ecs::EntityId_T i) { return string(40, (char)('a' + i % 26)) + to_string(i); });
+    }
+    SECTION("boxed") {
+        Ecs::Internal::ComponentArray<string> ca(Ecs::Storage::PAGED_INDEX, true);
+        VerifyBatchedRemoval(ca, [](Ecs::EntityId_T i) { return to_string(i); });
+    }
+}
+
 // ----------------------------------------------------------------
 // ComponentManager
 // ----------------------------------------------------------------
@@ -183,8 +506,8 @@ TEST_CASE( "verify ComponentManager" , "[ecs]") {
     manager.RegisterComponent<B>();
     REQUIRE( manager.Size() == 2 );
 
-    SECTION("Max Size Add/Remove/Get") {
-        int maxcount = (int)Ecs::MAX_ENTITY;
+    SECTION("Multi Page Add/Remove/Get") {
+        int maxcount = 4 * (int)Ecs::ENTITY_PAGE_SIZE + 1;
         for (int i = 0; i < maxcount; ++i) {
             manager.AddComponent<A>(i, {i, "NonSense"});
             manager.AddComponent<B>(i, {i, 4.2f});
@@ -208,13 +531,418 @@ TEST_CASE( "verify ComponentManager" , "[ecs]") {
     }
 }
 
+struct StoragePos { int x, y; };
+struct StorageGrid { std::array<int, 256> cells; };
+
+// same workload through every policy, spread over many pages
+template <typename Policy>
+void CheckStorage() {
+    Ecs::Internal::ComponentManager manager;
+    manager.RegisterComponent<StoragePos, Policy>();
+    manager.RegisterComponent<StorageGrid, Policy>();
+    Ecs::Storage::Index index = Policy::index;
+    bool boxed = Policy::boxed;
+    REQUIRE( manager.GetArray<StoragePos>()->IndexKind() == index );
+    REQUIRE( manager.GetArray<StorageGrid>()->Boxed() == boxed );
+
+    const int count = 3 * (int)Ecs::ENTITY_PAGE_SIZE;
+    for (int i = 0; i < count; ++i) {
+        Ecs::EntityId_T entity = Ecs::MakeEntity(i * 7, 1);
+        manager.AddComponent<StoragePos>(entity, {i, -i});
+        if (i % 100 == 0) {
+            StorageGrid grid;
+            grid.cells.fill(i);
+            manager.AddComponent<StorageGrid>(entity, grid);
+        }
+    }
+    for (int i = 0; i < count; i += 3) {
+        manager.RemoveComponent<StoragePos>(Ecs::MakeEntity(i * 7, 1));
+    }
+    manager.RemoveComponent<StorageGrid>(Ecs::MakeEntity(0, 1));
+
+    auto* pos = manager.GetArray<StoragePos>();
+    REQUIRE( pos->Count() == (Ecs::EntityId_T)(count - count / 3) );
+    REQUIRE( !pos->HasComponent(Ecs::MakeEntity(3 * 7, 1)) );
+    REQUIRE( !pos->HasComponent(Ecs::MakeEntity(4 * 7, 0)) );
+    REQUIRE( pos->GetComponent(Ecs::MakeEntity(4 * 7, 1)).x == 4 );
+
+    // boxed drivers and boxed lookups
+    int visited = 0;
+    bool match = true;
+    Ecs::View<StorageGrid>(manager).Each([&](Ecs::EntityId_T entity, StorageGrid &grid) {
+        match &= (int)Ecs::EntityIndex(entity) == grid.cells[255] * 7;
+        visited++;
+    });
+    REQUIRE( visited == (count + 99) / 100 - 1 );
+    visited = 0;
+    Ecs::View<StoragePos, StorageGrid>(manager).Each([&](Ecs::EntityId_T, StoragePos &p, StorageGrid &grid) {
+        match &= p.x == grid.cells[0] && p.y == -p.x;
+        visited++;
+    });
+    REQUIRE( match );
+    // every third position is gone, grids sit at multiples of 100
+    int expected = 0;
+    for (int i = 100; i < count; i += 100) expected += i % 3 != 0;
+    REQUIRE( visited == expected );
+}
+
+TEST_CASE( "verify storage policies" , "[ecs]") {
+    CheckStorage<Ecs::Storage::Paged>();
+    CheckStorage<Ecs::Storage::Dense>();
+    CheckStorage<Ecs::Storage::Hash>();
+    CheckStorage<Ecs::Storage::Boxed>();
+    CheckStorage<Ecs::Storage::Stable>();
+}
+
+TEST_CASE( "verify stable storage" , "[ecs]") {
+    struct P { int v; string name; };
+
+    Ecs::Internal::ComponentManager manager;
+    manager.RegisterComponent<P, Ecs::Storage::Stable>();
+    auto* array = manager.GetArray<P>();
+    REQUIRE( array->Stable() );
+
+    const int count = 2 * (int)Ecs::ENTITY_PAGE_SIZE;
+    std::vector<P*> held;
+    for (int i = 0; i < count; ++i) {
+        manager.AddComponent<P>(i, {i, "p"});
+        held.push_back(&manager.GetComponent<P>(i));
+    }
+
+    // removals leave holes, every other pointer stays put
+    for (int i = 0; i < count; i += 2) manager.RemoveComponent<P>(i);
+    REQUIRE( array->Size() == (Ecs::EntityId_T)count );
+    REQUIRE( array->Count() == (Ecs::EntityId_T)count / 2 );
+    bool stable = true;
+    for (int i = 1; i < count; i += 2) stable &= &manager.GetComponent<P>(i) == held[i] && held[i]->v == i;
+    REQUIRE( stable );
+
+    // iteration skips the holes
+    int visited = 0;
+    bool odd = true;
+    Ecs::View<P>(manager).Each([&](Ecs::EntityId_T entity, P &p) {
+        odd &= p.v % 2 == 1 && (int)entity == p.v;
+        visited++;
+    });
+    REQUIRE( odd );
+    REQUIRE( visited == count / 2 );
+
+    // adds refill holes before growing
+    manager.AddComponent<P>(count, {count, "refill"});
+    REQUIRE( array->Size() == (Ecs::EntityId_T)count );
+    REQUIRE( array->Find(count) < (Ecs::EntityId_T)count );
+
+    // compact packs the live components, moving some
+    manager.Compact();
+    REQUIRE( array->Size() == (Ecs::EntityId_T)count / 2 + 1 );
+    REQUIRE( array->Count() == array->Size() );
+    bool moved = true;
+    for (int i = 1; i < count; i += 2) moved &= manager.GetComponent<P>(i).v == i;
+    REQUIRE( moved );
+    REQUIRE( manager.GetComponent<P>(count).name == "refill" );
+    visited = 0;
+    Ecs::View<P>(manager).Each([&](Ecs::EntityId_T, P &) { visited++; });
+    REQUIRE( visited == count / 2 + 1 );
+
+    // compacting twice is a no-op, removal still works after
+    manager.Compact();
+    manager.RemoveComponent<P>(1);
+    REQUIRE( !array->HasComponent(1) );
+    REQUIRE( array->Count() == (Ecs::EntityId_T)count / 2 );
+}
+
+// ----------------------------------------------------------------
+// View
+// ----------------------------------------------------------------
+
+TEST_CASE( "verify View" , "[ecs]") {
+    struct A { int i; };
+    struct B { int i; string s; };
+
+    Ecs::Internal::ComponentManager manager;
+    manager.RegisterComponent<A>();
+    manager.RegisterComponent<B>();
+
+    int count = 3 * (int)Ecs::ENTITY_PAGE_SIZE;
+    for (int i = 0; i < count; ++i) {
+        manager.AddComponent<A>(i, {i});
+        if (i % 3 == 0) manager.AddComponent<B>(i, {i, "b"});
+    }
+
+    Ecs::View<A, B> view(manager);
+    // B is smaller and drives
+    REQUIRE( view.SizeHint() == (Ecs::EntityId_T)(count / 3) );
+
+    int visited = 0;
+    view.Each([&](Ecs::EntityId_T entity, A& a, B& b) {
+        REQUIRE( (int)entity == a.i );
+        REQUIRE( a.i == b.i );
+        a.i = -a.i;
+        visited++;
+    });
+    REQUIRE( visited == count / 3 );
+    REQUIRE( manager.GetComponent<A>(3).i == -3 );
+    REQUIRE( manager.GetComponent<A>(4).i == 4 );
+
+    // single component walks the whole dense array
+    visited = 0;
+    Ecs::View<A>(manager).Each([&](Ecs::EntityId_T, A&) { visited++; });
+    REQUIRE( visited == count );
+
+    // B optional, A drives even though B is smaller
+    visited = 0;
+    int withB = 0;
+    Ecs::View<const A, Ecs::Optional<const B>>(manager).Each([&](Ecs::EntityId_T entity, A const&, B const* b) {
+        if (b) {
+            REQUIRE( b->i == (int)entity );
+            withB++;
+        }
+        visited++;
+    });
+    REQUIRE( visited == count );
+    REQUIRE( withB == count / 3 );
+
+    // A without B
+    visited = 0;
+    Ecs::View<A>(manager).Exclude<B>().Each([&](Ecs::EntityId_T entity, A&) {
+        REQUIRE( entity % 3 != 0 );
+        visited++;
+    });
+    REQUIRE( visited == count - count / 3 );
+}
+
+// ----------------------------------------------------------------
+// SystemManager
+// ----------------------------------------------------------------
+
+template <size_t... Bits>
+struct BitSystem : public Ecs::System {
+    void OnSystemRegister() override {
+        int expand[] = { (mSignature.set(Bits, true), 0)..., 0 };
+        (void)expand;
+    }
+    void Update() override {}
+    bool Has(Ecs::EntityId_T entity) const { return mEntities.Contains(entity); }
+    size_t Count() const { return mEntities.Size(); }
+};
+
+TEST_CASE( "verify SystemManager" , "[ecs]") {
+    Ecs::Internal::SystemManager manager;
+    auto s0 = manager.RegisterSystem<BitSystem<0>>();
+    auto s01 = manager.RegisterSystem<BitSystem<0, 1>>();
+    auto s100 = manager.RegisterSystem<BitSystem<100>>();
+    auto sAll = manager.RegisterSystem<BitSystem<>>();
+    REQUIRE( manager.Size() == 4 );
+    REQUIRE( manager.GetSystem<BitSystem<0, 1>>() == s01 );
+
+    SECTION("ForEachSetBit visits every bit once") {
+        Ecs::Signature_T sig;
+        sig.set(0, true); sig.set(63, true); sig.set(64, true); sig.set(127, true);
+        vector<size_t> bits;
+        Ecs::ForEachSetBit(sig, [&](size_t bit) { bits.push_back(bit); });
+        REQUIRE( bits == vector<size_t>({0, 63, 64, 127}) );
+    }
+
+    SECTION("Membership follows signature transitions") {
+        Ecs::Signature_T none, sig0, sig01, sig01x;
+        sig0.set(0, true);
+        sig01 = sig0; sig01.set(1, true);
+        sig01x = sig01; sig01x.set(100, true);
+
+        manager.OnEntitySignatureUpdate(7, none, sig0);
+        REQUIRE( s0->Has(7) );
+        REQUIRE( !s01->Has(7) );
+        REQUIRE( sAll->Has(7) );
+
+        manager.OnEntitySignatureUpdate(7, sig0, sig01x);
+        REQUIRE( s0->Has(7) );
+        REQUIRE( s01->Has(7) );
+        REQUIRE( s100->Has(7) );
+
+        manager.OnEntitySignatureUpdate(7, sig01x, sig01);
+        REQUIRE( s01->Has(7) );
+        REQUIRE( !s100->Has(7) );
+
+        manager.OnEntitySignatureUpdate(7, sig01, none);
+        REQUIRE( !s0->Has(7) );
+        REQUIRE( !s01->Has(7) );
+        REQUIRE( !sAll->Has(7) );
+
+        manager.OnEntitySignatureUpdate(8, none, sig01);
+        manager.OnEntityDestroy(8, sig01);
+        REQUIRE( s0->Count() == 0 );
+        REQUIRE( s01->Count() == 0 );
+        REQUIRE( sAll->Count() == 0 );
+    }
+
+    SECTION("Excluded bits keep entities out") {
+        // has 0, not 5
+        struct Alive : public BitSystem<0> {
+            void OnSystemRegister() override { BitSystem<0>::OnSystemRegister(); mExclude.set(5, true); }
+        };
+        // anything without 5
+        struct NotDead : public BitSystem<> {
+            void OnSystemRegister() override { mExclude.set(5, true); }
+        };
+        auto alive = manager.RegisterSystem<Alive>();
+        auto notDead = manager.RegisterSystem<NotDead>();
+
+        Ecs::Signature_T none, sig0, sig05, sig5;
+        sig0.set(0, true);
+        sig05 = sig0; sig05.set(5, true);
+        sig5.set(5, true);
+
+        manager.OnEntitySignatureUpdate(7, none, sig05);
+        REQUIRE( !alive->Has(7) );
+        REQUIRE( !notDead->Has(7) );
+        REQUIRE( s0->Has(7) );
+
+        manager.OnEntitySignatureUpdate(7, sig05, sig0);
+        REQUIRE( alive->Has(7) );
+        REQUIRE( notDead->Has(7) );
+
+        manager.OnEntitySignatureUpdate(7, sig0, sig05);
+        REQUIRE( !alive->Has(7) );
+        REQUIRE( !notDead->Has(7) );
+
+        // losing the excluded bit last leaves an empty signature
+        manager.OnEntitySignatureUpdate(7, sig05, sig5);
+        manager.OnEntitySignatureUpdate(7, sig5, none);
+        REQUIRE( !notDead->Has(7) );
+        REQUIRE( !sAll->Has(7) );
+    }
+}
+
 // ----------------------------------------------------------------
-// EcsEngine
+// ThreadPool / Scheduler
 // ----------------------------------------------------------------
 
-TEST_CASE( "verify EcsEngine" , "[ecs]") {
+TEST_CASE( "verify ThreadPool" , "[ecs]") {
+    Ecs::ThreadPool pool(3);
+    REQUIRE( pool.WorkerCount() == 3 );
+
+    std::atomic<int> sum(0);
+    for (int i = 1; i <= 100; ++i) {
+        pool.Submit([&sum, i] { sum += i; });
+    }
+    pool.HelpUntil(nullptr, [&] { return sum.load() == 5050; });
+    REQUIRE( sum.load() == 5050 );
+}
+
+TEST_CASE( "verify ParallelEach" , "[ecs]") {
+    struct Pos { float x; };
+    struct Vel { float v; };
+
+    Ecs::Internal::ComponentManager manager;
+    manager.RegisterComponent<Pos>();
+    manager.RegisterComponent<Vel>();
+
+    const int count = 100000;
+    for (int i = 0; i < count; ++i) {
+        manager.AddComponent<Pos>(i, {0.f});
+        if (i % 4) manager.AddComponent<Vel>(i, {(float)i});
+    }
+
+    Ecs::ThreadPool pool(4);
+    std::atomic<int> visited(0);
+    // odd grain, rounded up to whole cache lines
+    Ecs::View<Pos, Vel>(manager).ParallelEach(&pool, 1000, [&](Ecs::EntityId_T, Pos& pos, Vel& vel) {
+        pos.x += vel.v;
+        visited++;
+    });
+    REQUIRE( visited.load() == count - count / 4 );
+    REQUIRE( manager.GetComponent<Pos>(5).x == 5.f );
+    REQUIRE( manager.GetComponent<Pos>(8).x == 0.f );
+    REQUIRE( manager.GetComponent<Pos>(count - 1).x == (float)(count - 1) );
+    // dense pages start on a cache line
+    REQUIRE( (uintptr_t)manager.GetArray<Pos>()->DataPage(0) % Ecs::CACHE_LINE_SIZE == 0 );
+    REQUIRE( (uintptr_t)manager.GetArray<Vel>()->DataPage(Ecs::ENTITY_PAGE_SIZE) % Ecs::CACHE_LINE_SIZE == 0 );
+
+    // serial fallback without a pool
+    visited = 0;
+    Ecs::View<Pos>(manager).ParallelEach(nullptr, 64, [&](Ecs::EntityId_T, Pos&) { visited++; });
+    REQUIRE( visited.load() == count );
+
+    // chunks cover the range exactly once
+    std::vector<std::atomic<int>> hits(10007);
+    Ecs::ParallelFor(&pool, hits.size(), 100, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) hits[i]++;
+    });
+    bool once = true;
+    for (auto &hit : hits) once &= hit.load() == 1;
+    REQUIRE( once );
+}
+
+// records the order systems ran in
+struct RunLog {
+    static std::atomic<int>& Clock() { static std::atomic<int> clock(0); return clock; }
+};
+
+struct CompA { int v; };
+struct CompB { int v; };
+
+template <int N>
+struct LoggedSystem : public Ecs::System {
+    int ranAt = -1;
+    void Update() override { ranAt = RunLog::Clock()++; }
+};
+
+struct WriteA : public LoggedSystem<0> {
+    void OnSystemRegister() override { Write<CompA>(); }
+};
+struct ReadA : public LoggedSystem<1> {
+    void OnSystemRegister() override { Read<CompA>(); }
+};
+struct ReadA2 : public LoggedSystem<2> {
+    void OnSystemRegister() override { Read<CompA>(); }
+};
+struct WriteB : public LoggedSystem<3> {
+    void OnSystemRegister() override { Write<CompB>(); Read<CompA>(); }
+};
+struct Exclusive : public LoggedSystem<4> {
+    void OnSystemRegister() override {}
+};
+
+TEST_CASE( "verify SystemManager schedule" , "[ecs]") {
+    using Ecs::Internal::SystemManager;
+    SystemManager manager;
+    auto writeA = manager.RegisterSystem<WriteA>();
+    auto readA = manager.RegisterSystem<ReadA>();
+    auto readA2 = manager.RegisterSystem<ReadA2>();
+    auto writeB = manager.RegisterSystem<WriteB>();
+    auto exclusive = manager.RegisterSystem<Exclusive>();
+
+    // readers of A share, writers of disjoint data share
+    REQUIRE( SystemManager::Conflicts(*writeA, *readA) );
+    REQUIRE( !SystemManager::Conflicts(*readA, *readA2) );
+    REQUIRE( !SystemManager::Conflicts(*readA, *writeB) );
+    REQUIRE( SystemManager::Conflicts(*exclusive, *readA) );
+
+    Ecs::ThreadPool pool(4);
+    for (int frame = 0; frame < 50; ++frame) {
+        manager.Update(&pool);
+        // conflicting pairs keep registration order
+        REQUIRE( writeA->ranAt < readA->ranAt );
+        REQUIRE( writeA->ranAt < readA2->ranAt );
+        REQUIRE( writeA->ranAt < writeB->ranAt );
+        REQUIRE( exclusive->ranAt > readA->ranAt );
+        REQUIRE( exclusive->ranAt > readA2->ranAt );
+        REQUIRE( exclusive->ranAt > writeB->ranAt );
+    }
+
+    // serial fallback
+    manager.Update(nullptr);
+    REQUIRE( writeA->ranAt + 1 == readA->ranAt );
+    REQUIRE( writeB->ranAt + 1 == exclusive->ranAt );
+}
+
+// ----------------------------------------------------------------
+// World
+// ----------------------------------------------------------------
+
+TEST_CASE( "verify World" , "[ecs]") {
     using namespace Ecs;
-    static EcsEngine& ecs = EcsEngine::GetInstance();
+    World ecs;
 
     struct IntComponent { int i; };
     struct FloatComponent { float f; };
@@ -222,11 +950,12 @@ TEST_CASE( "verify EcsEngine" , "[ecs]") {
     struct IntInc : public Ecs::System {
         void OnSystemRegister() override {
             REQUIRE(mSignature.none());
-            mSignature.set((size_t)ecs.GetComponentId<IntComponent>(),true);
+            mSignature.set((size_t)mWorld->GetComponentId<IntComponent>(),true);
+            Write<IntComponent>();
         }
         void Update() override {
             for (const auto &entity : mEntities) {
-                IntComponent& component =  ecs.GetComponent<IntComponent>(entity);
+                IntComponent& component =  mWorld->GetComponent<IntComponent>(entity);
                 component.i += 1;
             }
         }
@@ -234,11 +963,12 @@ TEST_CASE( "verify EcsEngine" , "[ecs]") {
     struct FloatInc : public Ecs::System {
         void OnSystemRegister() override {
             REQUIRE(mSignature.none());
-            mSignature.set(ecs.GetComponentId<FloatComponent>(),true);
+            mSignature.set(mWorld->GetComponentId<FloatComponent>(),true);
+            Write<FloatComponent>();
         }
         void Update() override {
             for (const auto &entity : mEntities) {
-                FloatComponent& component = ecs.GetComponent<FloatComponent>(entity);
+                FloatComponent& component = mWorld->GetComponent<FloatComponent>(entity);
                 component.f += .1f;
             }
         }
@@ -246,16 +976,15 @@ TEST_CASE( "verify EcsEngine" , "[ecs]") {
     struct NumMul : public Ecs::System {
         void OnSystemRegister() override {
             REQUIRE(mSignature.none());
-            mSignature.set(ecs.GetComponentId<IntComponent>(),true);
-            mSignature.set(ecs.GetComponentId<FloatComponent>(),true);
+            mSignature.set(mWorld->GetComponentId<IntComponent>(),true);
+            mSignature.set(mWorld->GetComponentId<FloatComponent>(),true);
+            Write<IntComponent, FloatComponent>();
         }
         void Update() override {
-            for (const auto &entity : mEntities) {
-                auto& componentI = ecs.GetComponent<IntComponent>(entity);
-                auto& componentF = ecs.GetComponent<FloatComponent>(entity);
+            mWorld->Each<IntComponent, FloatComponent>([](EntityId_T, IntComponent& componentI, FloatComponent& componentF) {
                 componentI.i *= 2;
                 componentF.f *= .5f;
-            }
+            });
         }
     };
 
@@ -264,9 +993,12 @@ TEST_CASE( "verify EcsEngine" , "[ecs]") {
     ecs.ResisterComponent<IntComponent>();
     ecs.ResisterComponent<FloatComponent>();
     // system
-    auto intInc = ecs.ResisterSystem<IntInc>();
-    auto floatInc = ecs.ResisterSystem<FloatInc>();
-    auto numMul = ecs.ResisterSystem<NumMul>();
+    ecs.ResisterSystem<IntInc>();
+    ecs.ResisterSystem<FloatInc>();
+    ecs.ResisterSystem<NumMul>();
+    auto intInc = ecs.GetSystem<IntInc>();
+    auto floatInc = ecs.GetSystem<FloatInc>();
+    auto numMul = ecs.GetSystem<NumMul>();
     // ett
     auto ett1 = ecs.CreateEntity();
     auto ett2 = ecs.CreateEntity();
@@ -283,8 +1015,9 @@ TEST_CASE( "verify EcsEngine" , "[ecs]") {
             numMul->Update();
         }
 
-        REQUIRE(ecs.GetComponent<IntComponent>(ett1).i == ((1+1)*2+1)*2);
-        REQUIRE(ecs.GetComponent<FloatComponent>(ett2).f == Approx((((2.2f+0.1f)*0.5f)+0.1f)*0.5f));
+        // NumMul only matches ett3
+        REQUIRE(ecs.GetComponent<IntComponent>(ett1).i == 1+1+1);
+        REQUIRE(ecs.GetComponent<FloatComponent>(ett2).f == Approx(2.2f+0.1f+0.1f));
         REQUIRE(ecs.GetComponent<IntComponent>(ett3).i == ((3+1)*2+1)*2);
         REQUIRE(ecs.GetComponent<FloatComponent>(ett3).f == Approx((((3.3f+0.1f)*0.5f)+0.1f)*0.5f));
     }
@@ -296,9 +1029,981 @@ TEST_CASE( "verify EcsEngine" , "[ecs]") {
             floatInc->Update();
         }
 
-        REQUIRE(ecs.GetComponent<IntComponent>(ett1).i == (((1*2)+1)*2)+1);
-        REQUIRE(ecs.GetComponent<FloatComponent>(ett2).f == Approx((((2.2f*0.5f)+0.1f)*0.5f)+0.1f));
+        REQUIRE(ecs.GetComponent<IntComponent>(ett1).i == 1+1+1);
+        REQUIRE(ecs.GetComponent<FloatComponent>(ett2).f == Approx(2.2f+0.1f+0.1f));
         REQUIRE(ecs.GetComponent<IntComponent>(ett3).i == (((3*2)+1)*2)+1);
         REQUIRE(ecs.GetComponent<FloatComponent>(ett3).f == Approx((((3.3f*0.5f)+0.1f)*0.5f)+0.1f));
     }
-}
\ No newline at end of file
+}
+
+TEST_CASE( "verify World batched components" , "[ecs]") {
+    using namespace Ecs;
+    World ecs;
+
+    struct Pos { float x, y; };
+    struct Vel { float x, y; };
+    struct Name { string s; };
+
+    ecs.ResisterComponent<Pos>();
+    ecs.ResisterComponent<Vel>();
+    ecs.ResisterComponent<Name>();
+    ecs.ResisterSystem<BitSystem<>>();
+
+    auto all = ecs.GetSystem<BitSystem<>>();
+    auto ett = ecs.CreateEntityWith<Pos, Vel, Name>({1.f, 2.f}, {3.f, 4.f}, {"spawned"});
+    REQUIRE( all->Has(ett) );
+    REQUIRE( ecs.GetComponent<Pos>(ett).y == 2.f );
+    REQUIRE( ecs.GetComponent<Vel>(ett).x == 3.f );
+    REQUIRE( ecs.GetComponent<const Pos>(ett).x == 1.f );
+    REQUIRE_THAT( ecs.GetComponent<Name>(ett).s, Catch::Equals("spawned") );
+
+    int moved = 0;
+    ecs.Each<Pos, Vel>([&](EntityId_T entity, Pos&, Vel&) {
+        if (entity == ett) moved++;
+    });
+    REQUIRE( moved == 1 );
+
+    ecs.RemoveComponents<Pos, Vel>(ett);
+    REQUIRE( ecs.GetView<Pos, Vel>().SizeHint() == 0 );
+    REQUIRE_THAT( ecs.GetComponent<Name>(ett).s, Catch::Equals("spawned") );
+
+    ecs.AddComponents<Vel>(ett, {5.f, 6.f});
+    REQUIRE( ecs.GetComponent<Vel>(ett).y == 6.f );
+    ecs.EmplaceComponent<Pos>(ett, Pos{7.f, 8.f});
+    REQUIRE( ecs.GetView<Pos, Vel>().SizeHint() == 1 );
+    ecs.DestroyEntity(ett);
+    REQUIRE( !all->Has(ett) );
+    REQUIRE( !ecs.IsAlive(ett) );
+
+    // stale handle, no-op even after the slot is reused
+    auto reused = ecs.CreateEntity();
+    ecs.DestroyEntity(ett);
+    REQUIRE( ecs.IsAlive(reused) );
+    ecs.DestroyEntity(reused);
+}
+
+TEST_CASE( "verify World bulk entities" , "[ecs]") {
+    using namespace Ecs;
+    World ecs;
+
+    struct Hp { int hp; };
+    struct Tag { string s; };
+    struct AllEntities : public BitSystem<> {};
+
+    ecs.ResisterComponent<Hp>();
+    ecs.ResisterComponent<Tag>();
+    ecs.ResisterSystem<AllEntities>();
+    auto all = ecs.GetSystem<AllEntities>();
+    size_t before = all->Count();
+
+    const int count = 50000;
+    vector<EntityId_T> wave;
+    ecs.CreateEntities(count, wave);
+    REQUIRE( wave.size() == count );
+    for (int i = 0; i < count; ++i) {
+        if (i % 2) ecs.AddComponents<Hp, Tag>(wave[i], {i}, {"odd"});
+        else ecs.AddComponents<Hp>(wave[i], {i});
+    }
+    REQUIRE( all->Count() == before + count );
+
+    // despawn the first half in one go
+    ecs.DestroyEntities(wave.data(), count / 2);
+    REQUIRE( all->Count() == before + count / 2 );
+    REQUIRE( !all->Has(wave[0]) );
+    REQUIRE( all->Has(wave[count - 1]) );
+    REQUIRE( ecs.GetComponent<Hp>(wave[count - 1]).hp == count - 1 );
+    REQUIRE_THAT( ecs.GetComponent<Tag>(wave[count - 1]).s, Catch::Equals("odd") );
+    REQUIRE( ecs.GetView<Hp>().SizeHint() == count / 2 );
+
+    ecs.DestroyEntities(wave.data() + count / 2, count - count / 2);
+    REQUIRE( all->Count() == before );
+
+    // stale handles never reach the entity reusing their slot
+    EntityId_T reused = ecs.CreateEntityWith<Hp>({7});
+    EntityId_T stale = wave[count - 1];
+    REQUIRE( EntityIndex(reused) == EntityIndex(stale) );
+    ecs.AddComponents<Tag>(stale, {"stale"});
+    ecs.RemoveComponents<Hp>(stale);
+    ecs.EmplaceComponent<Tag>(stale, Tag{"stale"});
+    ecs.DestroyEntities(&stale, 1);
+    REQUIRE( ecs.IsAlive(reused) );
+    REQUIRE( !ecs.HasComponent<Hp>(stale) );
+    REQUIRE( !ecs.HasComponent<Tag>(reused) );
+    REQUIRE( ecs.GetComponent<Hp>(reused).hp == 7 );
+
+    // repeated and stale handles in one batch, each entity goes once
+    EntityId_T a = ecs.CreateEntityWith<Hp, Tag>({1}, {"a"});
+    EntityId_T b = ecs.CreateEntityWith<Hp>({2});
+    EntityId_T batch[] = { a, stale, a, reused, a };
+    EntityId_T hps = ecs.GetView<Hp>().SizeHint();
+    ecs.DestroyEntities(batch, 5);
+    REQUIRE( !ecs.IsAlive(a) );
+    REQUIRE( !ecs.IsAlive(reused) );
+    REQUIRE( ecs.IsAlive(b) );
+    REQUIRE( ecs.GetComponent<Hp>(b).hp == 2 );
+    REQUIRE( ecs.GetView<Hp>().SizeHint() == hps - 2 );
+    REQUIRE( ecs.GetView<Tag>().SizeHint() == 0 );
+    REQUIRE( all->Has(b) );
+    REQUIRE( all->Count() == before + 1 );
+    // both slots went back on the free list once
+    EntityId_T c = ecs.CreateEntity();
+    EntityId_T d = ecs.CreateEntity();
+    EntityId_T e = ecs.CreateEntity();
+    REQUIRE( EntityIndex(c) != EntityIndex(d) );
+    REQUIRE( EntityIndex(e) != EntityIndex(c) );
+    REQUIRE( EntityIndex(e) != EntityIndex(d) );
+    REQUIRE( EntityIndex(e) != EntityIndex(b) );
+}
+
+TEST_CASE( "verify independent worlds" , "[ecs]") {
+    using namespace Ecs;
+
+    struct Counter { int n; };
+    // counts through its own world
+    struct Tick : public System {
+        void OnSystemRegister() override {
+            mSignature.set(ComponentTypeId<Counter>(), true);
+            Write<Counter>();
+        }
+        void Update() override {
+            mWorld->Each<Counter>([](EntityId_T, Counter& counter) { counter.n++; });
+        }
+    };
+
+    // one world per thread, same types, no shared state
+    const int worlds = 4;
+    vector<int> sums(worlds, 0);
+    vector<std::thread> threads;
+    for (int w = 0; w < worlds; ++w) {
+        threads.emplace_back([w, &sums] {
+            World world;
+            world.ResisterComponent<Counter>();
+            world.ResisterSystem<Tick>();
+            vector<EntityId_T> entities;
+            world.CreateEntities(1000 * (w + 1), entities);
+            for (auto entity : entities) world.AddComponent<Counter>(entity, {0});
+            for (int frame = 0; frame <= w; ++frame) world.Update();
+            world.Each<Counter>([&](EntityId_T, Counter& counter) { sums[w] += counter.n; });
+        });
+    }
+    for (auto &worker : threads) worker.join();
+    for (int w = 0; w < worlds; ++w) {
+        REQUIRE( sums[w] == 1000 * (w + 1) * (w + 1) );
+    }
+
+    // worlds on their own threads sharing one pool, each only helps
+    // with its own tasks and records into its own buffers
+    struct Hit {};
+    struct Mark : public System {
+        void OnSystemRegister() override {
+            mSignature.set(ComponentTypeId<Counter>(), true);
+            Read<Counter>();
+        }
+        void Update() override {
+            mWorld->GetView<const Counter>().ParallelEach(mWorld->GetThreadPool(), 64, [this](EntityId_T entity, Counter const& counter) {
+                if (counter.n % 2) mWorld->GetCommandBuffer().AddComponent<Hit>(entity, {});
+            });
+        }
+    };
+    auto pool = make_shared<ThreadPool>(3);
+    vector<size_t> hits(worlds, 0);
+    threads.clear();
+    sums.assign(worlds, 0);
+    for (int w = 0; w < worlds; ++w) {
+        threads.emplace_back([w, &sums, &hits, pool] {
+            World world;
+            world.SetThreadPool(pool);
+            world.ResisterComponent<Counter>();
+            world.ResisterComponent<Hit>();
+            world.ResisterSystem<Tick>();
+            world.ResisterSystem<Mark>();
+            vector<EntityId_T> entities;
+            world.CreateEntities(1000 * (w + 1), entities);
+            for (size_t i = 0; i < entities.size(); ++i) world.AddComponent<Counter>(entities[i], {(int)i});
+            for (int frame = 0; frame < 8; ++frame) world.Update();
+            world.Each<Counter>([&](EntityId_T entity, Counter& counter) {
+                sums[w] += counter.n;
+                hits[w] += world.HasComponent<Hit>(entity);
+            });
+            world.SetThreadPool(nullptr);
+        });
+    }
+    for (auto &worker : threads) worker.join();
+    for (int w = 0; w < worlds; ++w) {
+        int count = 1000 * (w + 1);
+        REQUIRE( sums[w] == count * (count - 1) / 2 + 8 * count );
+        // Mark runs after Tick and sees every parity at least once
+        REQUIRE( hits[w] == (size_t)count );
+    }
+
+    // a fresh world starts empty
+    World fresh;
+    fresh.ResisterComponent<Counter>();
+    REQUIRE( fresh.GetView<Counter>().SizeHint() == 0 );
+    REQUIRE( fresh.GetTick() == 1 );
+}
+
+TEST_CASE( "verify World clone" , "[ecs]") {
+    using namespace Ecs;
+
+    struct Pos { float x, y; };
+    struct Name { string s; };
+    struct Enemy {};
+    struct Anchor { int id; };
+    // moves enemies through its own world
+    struct Mover : public System {
+        void OnSystemRegister() override {
+            mSignature.set(ComponentTypeId<Pos>(), true);
+            mSignature.set(ComponentTypeId<Enemy>(), true);
+            Write<Pos>();
+        }
+        void Update() override {
+            mWorld->Each<Pos>([&](EntityId_T entity, Pos& pos) {
+                if (mEntities.Contains(entity)) pos.x += 1.f;
+            });
+        }
+        bool Has(EntityId_T entity) const { return mEntities.Contains(entity); }
+    };
+
+    World world;
+    world.ResisterComponent<Pos>();
+    world.ResisterComponent<Name>();
+    world.ResisterComponent<Enemy>();
+    world.ResisterComponent<Anchor, Storage::Stable>();
+    world.ResisterSystem<Mover>();
+
+    const int count = 3000;
+    vector<EntityId_T> entities;
+    world.CreateEntities(count, entities);
+    for (int i = 0; i < count; ++i) {
+        world.AddComponents<Pos, Name>(entities[i], {(float)i, 0.f}, {"e" + to_string(i)});
+        if (i % 2) world.AddComponent<Enemy>(entities[i], {});
+        if (i % 3 == 0) world.AddComponent<Anchor>(entities[i], {i});
+    }
+    world.RemoveComponents<Anchor>(entities[0]);
+    world.DestroyEntity(entities[1]);
+    world.Update();
+
+    auto fork = world.Clone();
+    REQUIRE( fork->GetTick() == world.GetTick() );
+    REQUIRE( !fork->IsAlive(entities[1]) );
+    REQUIRE( fork->GetComponent<Pos>(entities[3]).x == 4.f );
+    REQUIRE( fork->GetComponent<Name>(entities[3]).s == "e3" );
+    REQUIRE( fork->HasComponent<Enemy>(entities[3]) );
+    REQUIRE( !fork->HasComponent<Anchor>(entities[0]) );
+    REQUIRE( fork->GetComponent<Anchor>(entities[3]).id == 3 );
+    REQUIRE( fork->GetSystem<Mover>()->Has(entities[3]) );
+    REQUIRE( !fork->GetSystem<Mover>()->Has(entities[2]) );
+
+    // the fork runs on its own, original untouched
+    fork->Update();
+    fork->GetComponent<Name>(entities[3]).s = "forked";
+    auto spawned = fork->CreateEntityWith<Pos, Enemy>({0.f, 0.f}, {});
+    REQUIRE( fork->GetComponent<Pos>(entities[3]).x == 5.f );
+    REQUIRE( world.GetComponent<Pos>(entities[3]).x == 4.f );
+    REQUIRE( world.GetComponent<Name>(entities[3]).s == "e3" );
+    REQUIRE( fork->GetSystem<Mover>()->Has(spawned) );
+    REQUIRE( !world.IsAlive(spawned) );
+    REQUIRE( !world.GetSystem<Mover>()->Has(spawned) );
+
+    // identical ids come out of both
+    REQUIRE( world.CreateEntity() == spawned );
+}
+
+TEST_CASE( "verify rollback history" , "[ecs]") {
+    using namespace Ecs;
+
+    struct Pos { int x, y; };
+    struct Name { string s; };
+    struct Stunned {};
+    struct Anchor { int id; };
+    // moves everything not stunned
+    struct Move : public System {
+        void OnSystemRegister() override {
+            mSignature.set(ComponentTypeId<Pos>(), true);
+            Exclude<Stunned>();
+            Write<Pos>();
+        }
+        void Update() override {
+            for (auto entity : mEntities) mWorld->GetComponent<Pos>(entity).x += 1;
+        }
+        size_t Count() const { return mEntities.Size(); }
+    };
+
+    World world;
+    world.ResisterComponent<Pos>();
+    world.ResisterComponent<Name>();
+    world.ResisterComponent<Stunned>();
+    world.ResisterComponent<Anchor, Storage::Stable>();
+    world.ResisterSystem<Move>();
+
+    vector<EntityId_T> entities;
+    world.CreateEntities(2000, entities);
+    for (int i = 0; i < 2000; ++i) {
+        world.AddComponents<Pos, Name>(entities[i], {i, 0}, {"n"});
+        if (i % 4 == 0) world.AddComponent<Anchor>(entities[i], {i});
+    }
+
+    // same inputs per frame number, structural changes on some frames
+    auto frame = [&](int f) {
+        world.Update();
+        world.GetComponent<Pos>(entities[f]).y = f;
+        if (f % 3 == 0) world.CreateEntityWith<Pos, Name>({-f, 0}, {"spawn" + to_string(f)});
+        if (f % 5 == 0) world.DestroyEntity(entities[100 + f]);
+        if (f % 4 == 1) world.AddComponent<Stunned>(entities[f * 10], {});
+        if (f % 7 == 0) world.GetComponent<Name>(entities[f]).s = "renamed";
+        if (f % 6 == 0) world.RemoveComponents<Anchor>(entities[f * 4]);
+    };
+    // everything a rollback has to bring back
+    auto digest = [&]() {
+        long sum = 0;
+        world.Each<const Pos, const Name>([&](EntityId_T entity, Pos const &pos, Name const &name) {
+            sum += (long)EntityIndex(entity) * 31 + pos.x * 7 + pos.y * 3 + (long)name.s.size();
+        });
+        world.Each<const Anchor>([&](EntityId_T, Anchor const &anchor) { sum += anchor.id; });
+        return make_tuple(sum, world.GetView<Pos>().SizeHint(), world.GetSystem<Move>()->Count(), world.GetTick());
+    };
+
+    History history(world, 8, 3);
+    history.Save();
+    vector<decltype(digest())> digests(1, digest());
+    uint32_t first = world.GetTick();
+    for (int f = 1; f <= 20; ++f) {
+        frame(f);
+        history.Save();
+        digests.push_back(digest());
+    }
+    // at least the last 8 ticks, older keyframe groups evicted
+    REQUIRE( history.Size() >= 8 );
+    REQUIRE( history.Size() < 8 + 3 );
+    REQUIRE( history.Has(first + 20) );
+    REQUIRE( history.Has(first + 13) );
+    REQUIRE( !history.Has(first) );
+    REQUIRE( !history.Restore(first) );
+
+    // every saved tick comes back exactly, in any order
+    for (uint32_t t : {first + 13, first + 20, first + 16, first + 14}) {
+        REQUIRE( history.Restore(t) );
+        REQUIRE( (digest() == digests[t - first]) );
+    }
+
+    // resimulate from a rollback, saves overwrite the old future
+    REQUIRE( history.Restore(first + 15) );
+    for (int f = 16; f <= 20; ++f) {
+        frame(f);
+        history.Save();
+        REQUIRE( (digest() == digests[f]) );
+    }
+    REQUIRE( history.Restore(first + 18) );
+    REQUIRE( (digest() == digests[18]) );
+    REQUIRE( world.GetComponent<Name>(entities[14]).s == "renamed" );
+    REQUIRE( world.HasComponent<Stunned>(entities[170]) );
+}
+
+TEST_CASE( "verify rollback resimulation" , "[ecs]") {
+    using namespace Ecs;
+
+    struct Pos { int x; };
+    struct Rank { int order; };
+    // stamps visit order, counts what changed since its last run
+    struct Sweep : public System {
+        void OnSystemRegister() override {
+            mSignature.set(ComponentTypeId<Pos>(), true);
+            mSignature.set(ComponentTypeId<Rank>(), true);
+            Read<Pos>();
+            Write<Rank>();
+        }
+        void Update() override {
+            changed = 0;
+            mWorld->GetView<const Pos>().Changed<Pos>(mLastRunTick).Each([&](EntityId_T, Pos const&) { changed++; });
+            seen.clear();
+            for (auto entity : mEntities) {
+                mWorld->GetComponent<Rank>(entity).order = (int)seen.size();
+                seen.push_back(entity);
+            }
+        }
+        vector<EntityId_T> seen;
+        int changed = 0;
+    };
+
+    // members enter in reverse index order, swap-removal shuffles them further
+    auto setup = [](World &world, vector<EntityId_T> &entities) {
+        world.ResisterComponent<Pos>();
+        world.ResisterComponent<Rank>();
+        world.ResisterSystem<Sweep>();
+        world.CreateEntities(300, entities);
+        for (int i = 299; i >= 0; --i) world.AddComponents<Pos, Rank>(entities[i], {i}, {0});
+    };
+    auto frame = [](World &world, vector<EntityId_T> const &entities, int f) {
+        world.Update();
+        world.GetComponent<Pos>(entities[f]).x += f;
+        world.GetComponent<Pos>(entities[f + 50]).x += 1;
+        if (f % 3 == 0) world.CreateEntityWith<Pos, Rank>({-f}, {0});
+        if (f % 4 == 0) world.DestroyEntity(entities[100 + f]);
+        if (f % 5 == 0) world.RemoveComponents<Rank>(entities[200 + f]);
+    };
+    auto digest = [](World &world) {
+        vector<tuple<EntityId_T, int, int>> rows;
+        world.Each<const Pos, const Rank>([&](EntityId_T entity, Pos const &pos, Rank const &rank) {
+            rows.emplace_back(entity, pos.x, rank.order);
+        });
+        auto sweep = world.GetSystem<Sweep>();
+        return make_tuple(rows, sweep->seen, sweep->changed, world.GetTick());
+    };
+
+    World straight;
+    vector<EntityId_T> straightEntities;
+    setup(straight, straightEntities);
+    vector<decltype(digest(straight))> expected(1, digest(straight));
+    for (int f = 1; f <= 12; ++f) {
+        frame(straight, straightEntities, f);
+        expected.push_back(digest(straight));
+    }
+    // frame 12 sees the two writes of frame 11
+    REQUIRE( get<2>(expected[12]) == 2 );
+
+    World replayed;
+    vector<EntityId_T> replayedEntities;
+    setup(replayed, replayedEntities);
+    REQUIRE( straightEntities == replayedEntities );
+    History history(replayed, 16, 4);
+    history.Save();
+    uint32_t first = replayed.GetTick();
+    for (int f = 1; f <= 12; ++f) {
+        frame(replayed, replayedEntities, f);
+        history.Save();
+    }
+    // the future is thrown away and simulated again, every frame as before
+    for (int from : {6, 9, 3}) {
+        REQUIRE( history.Restore(first + from) );
+        for (int f = from + 1; f <= 12; ++f) {
+            frame(replayed, replayedEntities, f);
+            history.Save();
+            REQUIRE( (digest(replayed) == expected[f]) );
+        }
+    }
+}
+
+TEST_CASE( "verify EntityCommandBuffer" , "[ecs]") {
+    using namespace Ecs;
+    World ecs;
+
+    struct Bullet { int ttl; };
+    struct Hit { int damage; };
+    // entities owning Bullet
+    struct Bullets : public System {
+        void OnSystemRegister() override { mSignature.set(ComponentTypeId<Bullet>(), true); }
+        void Update() override {}
+        size_t Count() const { return mEntities.Size(); }
+        bool Has(EntityId_T entity) const { return mEntities.Contains(entity); }
+    };
+
+    ecs.ResisterComponent<Bullet>();
+    ecs.ResisterComponent<Hit>();
+    ecs.ResisterSystem<Bullets>();
+    auto bullets = ecs.GetSystem<Bullets>();
+
+    const int count = 3000;
+    vector<EntityId_T> wave;
+    ecs.CreateEntities(count, wave);
+    for (int i = 0; i < count; ++i) {
+        ecs.AddComponent<Bullet>(wave[i], {i % 3});
+    }
+    REQUIRE( bullets->Count() == count );
+
+    // structural changes while iterating
+    EntityCommandBuffer buffer;
+    ecs.Each<Bullet>([&](EntityId_T entity, Bullet& bullet) {
+        if (bullet.ttl == 0) buffer.DestroyEntity(entity);
+        else if (bullet.ttl == 1) buffer.AddComponent<Hit>(entity, {10});
+        else buffer.RemoveComponent<Bullet>(entity);
+    });
+    REQUIRE( bullets->Count() == count );
+    ecs.Playback(buffer);
+    REQUIRE( buffer.Empty() );
+
+    REQUIRE( bullets->Count() == count / 3 );
+    REQUIRE( !ecs.IsAlive(wave[0]) );
+    REQUIRE( bullets->Has(wave[1]) );
+    REQUIRE( ecs.GetComponent<Hit>(wave[1]).damage == 10 );
+    REQUIRE( !bullets->Has(wave[2]) );
+    REQUIRE( ecs.GetView<Hit>().SizeHint() == count / 3 );
+
+    SECTION("last command per entity wins") {
+        buffer.AddComponent<Hit>(wave[2], {1});
+        buffer.RemoveComponent<Hit>(wave[2]);
+        buffer.RemoveComponent<Bullet>(wave[1]);
+        buffer.AddComponent<Bullet>(wave[1], {7});
+        buffer.EmplaceComponent<Hit>(wave[1], Hit{20});
+        // dropped, destroyed by the same buffer
+        buffer.AddComponent<Bullet>(wave[4], {1});
+        buffer.DestroyEntity(wave[4]);
+        buffer.DestroyEntity(wave[4]);
+        // dropped, stale
+        buffer.AddComponent<Bullet>(wave[0], {1});
+        ecs.Playback(buffer);
+
+        REQUIRE( ecs.GetView<Hit>().SizeHint() == count / 3 - 1 );
+        REQUIRE( bullets->Has(wave[1]) );
+        REQUIRE( ecs.GetComponent<Bullet>(wave[1]).ttl == 7 );
+        REQUIRE( ecs.GetComponent<Hit>(wave[1]).damage == 20 );
+        REQUIRE( !ecs.IsAlive(wave[4]) );
+        REQUIRE( bullets->Count() == count / 3 - 1 );
+    }
+
+    SECTION("engine buffer plays back after Update") {
+        ecs.GetCommandBuffer().RemoveComponent<Bullet>(wave[1]);
+        REQUIRE( bullets->Has(wave[1]) );
+        ecs.Update();
+        REQUIRE( !bullets->Has(wave[1]) );
+    }
+
+    for (auto entity : wave) {
+        if (ecs.IsAlive(entity)) buffer.DestroyEntity(entity);
+    }
+    ecs.Playback(buffer);
+    REQUIRE( bullets->Count() == 0 );
+}
+
+TEST_CASE( "verify thread-local command buffers" , "[ecs]") {
+    using namespace Ecs;
+
+    SECTION("ReserveEntity is lock free and unique") {
+        Internal::EntityManager manager;
+        vector<EntityId_T> freed(1000);
+        manager.CreateEntities(freed.size(), freed.data());
+        manager.DestroyEntities(freed.data(), freed.size());
+
+        // pending handles only, no slot is touched
+        ThreadPool pool(4);
+        vector<EntityId_T> reserved(5000);
+        ParallelFor(&pool, reserved.size(), 100, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) reserved[i] = manager.ReserveEntity();
+        });
+        REQUIRE( manager.Size() == 0 );
+        bool pending = true;
+        for (auto entity : reserved) pending &= Internal::EntityManager::IsReserved(entity) && !manager.IsAlive(entity);
+        REQUIRE( pending );
+        REQUIRE( manager.Resolve(reserved[0]) == NULL_ENTITY );
+        sort(reserved.begin(), reserved.end());
+        REQUIRE( unique(reserved.begin(), reserved.end()) == reserved.end() );
+
+        // created in the order asked for, freed ids first, once each
+        vector<EntityId_T> created;
+        for (auto entity : reserved) created.push_back(manager.CreateReserved(entity));
+        REQUIRE( manager.Size() == reserved.size() );
+        REQUIRE( EntityIndex(created[0]) == EntityIndex(freed.back()) );
+        REQUIRE( created[freed.size()] == freed.size() );
+        REQUIRE( manager.CreateReserved(reserved[7]) == created[7] );
+        REQUIRE( manager.Resolve(reserved[7]) == created[7] );
+        REQUIRE( manager.Size() == reserved.size() );
+        bool alive = true;
+        for (auto entity : created) alive &= manager.IsAlive(entity);
+        REQUIRE( alive );
+
+        // forgotten, later handles count from 0 again
+        manager.ClearReserved();
+        REQUIRE( manager.Resolve(reserved[7]) == NULL_ENTITY );
+        REQUIRE( manager.CreateReserved(reserved[7]) == NULL_ENTITY );
+        REQUIRE( manager.ReserveEntity() == reserved[0] );
+    }
+
+    SECTION("reserved ids do not depend on the thread count") {
+        struct Emitter { int rate; };
+        struct Particle { int source; };
+
+        // same emitters, heavier work on some items to shuffle timing
+        auto run = [](size_t threads) {
+            World ecs;
+            ecs.ResisterComponent<Emitter>();
+            ecs.ResisterComponent<Particle>();
+            vector<EntityId_T> emitters;
+            ecs.CreateEntities(4000, emitters);
+            for (size_t i = 0; i < emitters.size(); ++i) {
+                ecs.AddComponent<Emitter>(emitters[i], {(int)(i % 3)});
+            }
+            // freed slots in the mix
+            ecs.DestroyEntities(emitters.data(), 500);
+
+            if (threads) ecs.SetThreadPool(make_shared<ThreadPool>(threads));
+            ecs.ParallelEach<Emitter>([&](EntityId_T entity, Emitter& emitter) {
+                volatile int spin = 0;
+                for (EntityId_T n = 0; n < EntityIndex(entity) % 7 * 2000; ++n) spin = spin + 1;
+                auto &buffer = ecs.GetCommandBuffer();
+                buffer.SetSortKey(EntityIndex(entity));
+                for (int n = 0; n < emitter.rate; ++n) {
+                    auto particle = ecs.ReserveEntity();
+                    buffer.AddComponent<Particle>(particle, {(int)EntityIndex(entity)});
+                    if (n == 1) buffer.DestroyEntity(particle);
+                }
+            }, 64);
+            ecs.FlushCommandBuffers();
+            ecs.SetThreadPool(nullptr);
+
+            vector<pair<EntityId_T, int>> particles;
+            ecs.Each<Particle>([&](EntityId_T entity, Particle& particle) {
+                particles.push_back({entity, particle.source});
+            });
+            return particles;
+        };
+        // one survivor per emitting emitter, the second particle dies
+        size_t emitting = 0;
+        for (int i = 500; i < 4000; ++i) emitting += i % 3 != 0;
+        auto serial = run(0);
+        REQUIRE( serial.size() == emitting );
+        REQUIRE( (run(4) == serial) );
+        REQUIRE( (run(4) == serial) );
+    }
+
+    SECTION("per-thread buffers merge by sort key") {
+        World ecs;
+
+        struct Emitter { int rate; };
+        struct Particle { int source; };
+        struct Score { int last; };
+
+        ecs.ResisterComponent<Emitter>();
+        ecs.ResisterComponent<Particle>();
+        ecs.ResisterComponent<Score>();
+
+        const int count = 20000;
+        vector<EntityId_T> emitters;
+        ecs.CreateEntities(count, emitters);
+        for (int i = 0; i < count; ++i) {
+            ecs.AddComponent<Emitter>(emitters[i], {i % 2 + 1});
+        }
+        auto target = ecs.CreateEntity();
+
+        ecs.SetThreadPool(make_shared<ThreadPool>(4));
+        ecs.ParallelEach<Emitter>([&](EntityId_T entity, Emitter& emitter) {
+            auto &buffer = ecs.GetCommandBuffer();
+            buffer.SetSortKey(EntityIndex(entity));
+            for (int n = 0; n < emitter.rate; ++n) {
+                auto particle = ecs.ReserveEntity();
+                buffer.AddComponent<Particle>(particle, {(int)EntityIndex(entity)});
+            }
+            // every work item hits the same entity, the highest key wins
+            buffer.AddComponent<Score>(target, {(int)EntityIndex(entity)});
+        }, 512);
+        ecs.FlushCommandBuffers();
+        ecs.SetThreadPool(nullptr);
+
+        REQUIRE( ecs.GetView<Particle>().SizeHint() == count / 2 * 3 );
+        int highest = 0;
+        for (auto entity : emitters) highest = max(highest, (int)EntityIndex(entity));
+        REQUIRE( ecs.GetComponent<Score>(target).last == highest );
+
+        vector<EntityId_T> particles;
+        ecs.Each<Particle>([&](EntityId_T entity, Particle&) { particles.push_back(entity); });
+        ecs.DestroyEntities(particles);
+        ecs.DestroyEntities(emitters);
+        ecs.DestroyEntity(target);
+    }
+
+    SECTION("reserved ids can be used before playback") {
+        World ecs;
+
+        struct Hp { int hp; };
+        ecs.ResisterComponent<Hp>();
+
+        // nothing named it, dropped at the end of the frame
+        auto doomed = ecs.ReserveEntity();
+        REQUIRE( !ecs.IsAlive(doomed) );
+        REQUIRE( !ecs.HasComponent<Hp>(doomed) );
+        ecs.DestroyEntity(doomed);
+        ecs.Update();
+        REQUIRE( !ecs.IsAlive(doomed) );
+        REQUIRE( ecs.GetView<Hp>().SizeHint() == 0 );
+
+        // created by the playback of the buffer naming it
+        auto spawned = ecs.ReserveEntity();
+        ecs.GetCommandBuffer().AddComponent<Hp>(spawned, {2});
+        REQUIRE( !ecs.IsAlive(spawned) );
+        EntityCommandBuffer own;
+        own.AddComponent<Hp>(spawned, {5});
+        ecs.Playback(own);
+        REQUIRE( ecs.IsAlive(spawned) );
+        REQUIRE( ecs.GetComponent<Hp>(spawned).hp == 5 );
+        ecs.FlushCommandBuffers();
+        REQUIRE( ecs.GetView<Hp>().SizeHint() == 1 );
+        ecs.Each<Hp>([&](EntityId_T, Hp& hp) { REQUIRE( hp.hp == 2 ); });
+        // forgotten after the flush
+        REQUIRE( !ecs.IsAlive(spawned) );
+
+        auto added = ecs.ReserveEntity();
+        auto emplaced = ecs.ReserveEntity();
+        ecs.AddComponents<Hp>(added, {3});
+        ecs.EmplaceComponent<Hp>(emplaced, Hp{4});
+        REQUIRE( ecs.IsAlive(added) );
+        REQUIRE( ecs.HasComponent<Hp>(added) );
+        REQUIRE( ecs.GetComponent<Hp>(added).hp == 3 );
+        REQUIRE( ecs.GetComponent<Hp>(emplaced).hp == 4 );
+
+        auto batch = ecs.ReserveEntity();
+        ecs.DestroyEntities(&batch, 1);
+        ecs.RemoveComponents<Hp>(added);
+        REQUIRE( !ecs.IsAlive(batch) );
+        REQUIRE( !ecs.HasComponent<Hp>(added) );
+    }
+
+    SECTION("threads outside the pool record into their own buffer") {
+        World ecs;
+
+        struct Hp { int hp; };
+        ecs.ResisterComponent<Hp>();
+        ecs.SetThreadPool(make_shared<ThreadPool>(2));
+
+        const int count = 5000;
+        vector<EntityId_T> entities;
+        ecs.CreateEntities(2 * count, entities);
+        array<EntityCommandBuffer*, 2> buffers;
+        vector<thread> threads;
+        for (int t = 0; t < 2; ++t) {
+            threads.emplace_back([&, t] {
+                buffers[t] = &ecs.GetCommandBuffer();
+                for (int i = t * count; i < (t + 1) * count; ++i) {
+                    ecs.GetCommandBuffer().AddComponent<Hp>(entities[i], {i});
+                }
+            });
+        }
+        for (auto &worker : threads) worker.join();
+        REQUIRE( buffers[0] != buffers[1] );
+        REQUIRE( buffers[0] != &ecs.GetCommandBuffer() );
+
+        ecs.FlushCommandBuffers();
+        REQUIRE( ecs.GetView<Hp>().SizeHint() == 2 * count );
+        REQUIRE( ecs.GetComponent<Hp>(entities[count + 7]).hp == count + 7 );
+        ecs.SetThreadPool(nullptr);
+    }
+}
+
+TEST_CASE( "verify change tracking" , "[ecs]") {
+    using namespace Ecs;
+
+    struct Transform { float x; };
+    struct Mesh { int id; };
+
+    Internal::ComponentManager manager;
+    manager.RegisterComponent<Transform>();
+    manager.RegisterComponent<Mesh>();
+
+    // static props, never touched after the first tick
+    const int count = 5000;
+    for (int i = 0; i < count; ++i) {
+        manager.AddComponent<Transform>(i, {0.f});
+        manager.AddComponent<Mesh>(i, {i});
+    }
+    auto* transforms = manager.GetArray<Transform>();
+    REQUIRE( transforms->AddedTick(10) == 1 );
+    REQUIRE( transforms->ChangedTick(10) == 1 );
+    REQUIRE( transforms->ChangedTick(count) == 0 );
+
+    manager.SetTick(2);
+    int visited = 0;
+    View<Transform, Mesh>(manager).Changed<Transform>(2).Each([&](EntityId_T, Transform&, Mesh&) { visited++; });
+    REQUIRE( visited == 0 );
+
+    // read only access leaves ticks alone
+    View<const Transform, const Mesh>(manager).Each([&](EntityId_T, Transform const&, Mesh const&) { visited++; });
+    REQUIRE( visited == count );
+    REQUIRE( transforms->ChangedTick(10) == 1 );
+
+    // mutable access marks
+    manager.GetComponent<Transform>(10).x = 1.f;
+    manager.GetComponent<Transform>(4000).x = 1.f;
+    manager.AddComponent<Transform>(count, {2.f});
+    REQUIRE( transforms->ChangedTick(10) == 2 );
+
+    vector<EntityId_T> changed;
+    View<const Transform>(manager).Changed<Transform>(2).Each([&](EntityId_T entity, Transform const&) {
+        changed.push_back(entity);
+    });
+    REQUIRE( changed == vector<EntityId_T>({10, 4000, (EntityId_T)count}) );
+
+    vector<EntityId_T> added;
+    View<const Mesh, const Transform>(manager).Added<Transform>(2).Each([&](EntityId_T entity, Mesh const&, Transform const&) {
+        added.push_back(entity);
+    });
+    REQUIRE( added.empty() );
+    View<const Transform>(manager).Added<Transform>(2).Each([&](EntityId_T entity, Transform const&) {
+        added.push_back(entity);
+    });
+    REQUIRE( added == vector<EntityId_T>({(EntityId_T)count}) );
+
+    // ticks follow a component relocated by swap-remove
+    manager.RemoveComponent<Transform>(0);
+    REQUIRE( transforms->AddedTick(count) == 2 );
+    changed.clear();
+    View<const Transform>(manager).Changed<Transform>(2).Each([&](EntityId_T entity, Transform const&) {
+        changed.push_back(entity);
+    });
+    REQUIRE( changed.size() == 3 );
+
+    // a mutable walk marks everything it visits
+    manager.SetTick(3);
+    View<Mesh, const Transform>(manager).Each([&](EntityId_T, Mesh&, Transform const&) {});
+    REQUIRE( manager.GetArray<Mesh>()->ChangedTick(1) == 3 );
+    REQUIRE( transforms->ChangedTick(1) == 1 );
+    REQUIRE( manager.GetArray<Mesh>()->ChangedTick(0) == 1 );
+}
+
+TEST_CASE( "verify reactive observers" , "[ecs]") {
+    using namespace Ecs;
+    World ecs;
+
+    struct Body { float mass; };
+    struct Shape { int kind; };
+    // physics body creation, reacts to Body coming and going
+    struct Physics : public System {
+        void OnSystemRegister() override {
+            ObserveAdded<Body, Shape>();
+            ObserveRemoved<Body>();
+            ObserveSignatures();
+            Write<Body>();
+        }
+        void Update() override {}
+        void OnComponentsAdded(ComponentId_T id, const EntityId_T* entities, size_t count) override {
+            calls++;
+            if (id == ComponentTypeId<Body>()) added.insert(added.end(), entities, entities + count);
+        }
+        void OnComponentsRemoved(ComponentId_T, const EntityId_T* entities, size_t count) override {
+            calls++;
+            removed.insert(removed.end(), entities, entities + count);
+        }
+        void OnSignaturesChanged(const SignatureEvent* events, size_t count) override {
+            calls++;
+            transitions.insert(transitions.end(), events, events + count);
+        }
+        int calls = 0;
+        vector<EntityId_T> added;
+        vector<EntityId_T> removed;
+        vector<SignatureEvent> transitions;
+    };
+
+    ecs.ResisterComponent<Body>();
+    ecs.ResisterSystem<Physics>();
+    // registered after its observer
+    ecs.ResisterComponent<Shape>();
+    auto physics = ecs.GetSystem<Physics>();
+
+    vector<EntityId_T> bodies;
+    ecs.CreateEntities(100, bodies);
+    for (auto entity : bodies) {
+        ecs.AddComponents<Body, Shape>(entity, {1.f}, {0});
+    }
+    ecs.RemoveComponents<Body>(bodies[0]);
+    ecs.DestroyEntity(bodies[1]);
+    REQUIRE( physics->calls == 0 );
+
+    ecs.Update();
+    // one batch per type: added Body, added Shape, removed Body, signatures
+    REQUIRE( physics->calls == 4 );
+    REQUIRE( physics->added == bodies );
+    REQUIRE( physics->removed == vector<EntityId_T>({bodies[0], bodies[1]}) );
+    REQUIRE( physics->transitions.size() == 100 + 2 );
+    REQUIRE( physics->transitions.back().entity == bodies[1] );
+    REQUIRE( physics->transitions.back().after.none() );
+
+    // nothing happened, nothing dispatched
+    ecs.Update();
+    REQUIRE( physics->calls == 4 );
+
+    // deferred changes show up with the frame that applies them
+    ecs.GetCommandBuffer().RemoveComponent<Body>(bodies[2]);
+    ecs.Update();
+    REQUIRE( physics->calls == 6 );
+    REQUIRE( physics->removed.back() == bodies[2] );
+
+    bodies.erase(bodies.begin() + 1);
+    ecs.DestroyEntities(bodies);
+    ecs.Update();
+}
+
+TEST_CASE( "verify tag components" , "[ecs]") {
+    using namespace Ecs;
+    World ecs;
+
+    struct Player {};
+    struct Frozen {};
+    struct Speed { float v; };
+    // players that are not frozen
+    struct Movers : public System {
+        void OnSystemRegister() override {
+            mSignature.set(ComponentTypeId<Player>(), true);
+            mSignature.set(ComponentTypeId<Speed>(), true);
+            Exclude<Frozen>();
+        }
+        void Update() override {}
+        bool Has(EntityId_T entity) const { return mEntities.Contains(entity); }
+    };
+    // sees tags come and go like any other component
+    struct FreezeLog : public System {
+        void OnSystemRegister() override {
+            ObserveAdded<Frozen>();
+            ObserveRemoved<Frozen, Player>();
+        }
+        void Update() override {}
+        void OnComponentsAdded(ComponentId_T id, const EntityId_T* entities, size_t count) override {
+            if (id == ComponentTypeId<Frozen>()) frozen.insert(frozen.end(), entities, entities + count);
+        }
+        void OnComponentsRemoved(ComponentId_T id, const EntityId_T* entities, size_t count) override {
+            auto &out = id == ComponentTypeId<Frozen>() ? thawed : players;
+            out.insert(out.end(), entities, entities + count);
+        }
+        vector<EntityId_T> frozen;
+        vector<EntityId_T> thawed;
+        vector<EntityId_T> players;
+    };
+
+    ecs.ResisterComponent<Player>();
+    ecs.ResisterComponent<Frozen>();
+    ecs.ResisterComponent<Speed>();
+    ecs.ResisterSystem<Movers>();
+    ecs.ResisterSystem<FreezeLog>();
+    auto movers = ecs.GetSystem<Movers>();
+    auto log = ecs.GetSystem<FreezeLog>();
+
+    auto player = ecs.CreateEntityWith<Player, Speed>({}, {2.f});
+    auto npc = ecs.CreateEntityWith<Speed>({1.f});
+    REQUIRE( ecs.HasComponent<Player>(player) );
+    REQUIRE( ecs.GetComponentId<Player>() == ComponentTypeId<Player>() );
+    REQUIRE( !ecs.HasComponent<Player>(npc) );
+    REQUIRE( movers->Has(player) );
+    REQUIRE( !movers->Has(npc) );
+
+    // toggling a tag only flips a bit and updates membership
+    ecs.AddComponent<Frozen>(player, {});
+    REQUIRE( !movers->Has(player) );
+    ecs.RemoveComponents<Frozen>(player);
+    REQUIRE( movers->Has(player) );
+
+    int visited = 0;
+    ecs.GetView<Speed>().With<Player>().Exclude<Frozen>().Each([&](EntityId_T entity, Speed&) {
+        REQUIRE( entity == player );
+        visited++;
+    });
+    REQUIRE( visited == 1 );
+
+    // deferred toggles
+    ecs.GetCommandBuffer().AddComponent<Frozen>(player, {});
+    ecs.GetCommandBuffer().AddComponent<Player>(npc, {});
+    ecs.FlushCommandBuffers();
+    REQUIRE( ecs.HasComponent<Frozen>(player) );
+    REQUIRE( !movers->Has(player) );
+    REQUIRE( movers->Has(npc) );
+
+    // setting a bit that is already set is no event
+    ecs.AddComponent<Frozen>(player, {});
+    REQUIRE( log->frozen.empty() );
+    ecs.Update();
+    REQUIRE( log->frozen == vector<EntityId_T>({player, player}) );
+    REQUIRE( log->thawed == vector<EntityId_T>({player}) );
+    REQUIRE( log->players.empty() );
+
+    ecs.DestroyEntity(player);
+    ecs.DestroyEntities(&npc, 1);
+    REQUIRE( !movers->Has(npc) );
+    ecs.Update();
+    REQUIRE( log->thawed == vector<EntityId_T>({player, player}) );
+    REQUIRE( log->players == vector<EntityId_T>({player, npc}) );
+}